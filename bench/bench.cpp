@@ -0,0 +1,1382 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <thread>
+#include <SDL.h>
+
+#include "render.h"
+#include "utils.h"
+#include "blit.h"
+#include "frame_pipeline.h"
+#include "input.h"
+#include "perf_counter.h"
+#include "profiler.h"
+#include "levels.h"
+#include "capture.h"
+#include "flow_field.h"
+#include "visibility.h"
+
+
+// Every operator new and delete of the program (plain, aligned, array and nothrow forms) goes through
+// these, so the bench can prove the frame loop allocates nothing once warmed up. Memory that C
+// libraries such as SDL get from malloc directly is not counted.
+static std::atomic<size_t> g_alloc_count{0};
+
+// Out of line, so the compiler never pairs an inlined free with the operator new it came from
+__attribute__((noinline)) static void* counted_alloc(const size_t size, const size_t alignment) noexcept
+{
+    g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    if (alignment <= alignof(std::max_align_t)) return std::malloc(size ? size : 1);
+    return std::aligned_alloc(alignment, (std::max<size_t>(size, 1) + alignment - 1) / alignment * alignment);
+}
+
+__attribute__((noinline)) static void counted_free(void* ptr) noexcept { std::free(ptr); }
+
+static void* counted_new(const size_t size, const size_t alignment)
+{
+    if (void* ptr = counted_alloc(size, alignment)) return ptr;
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size) { return counted_new(size, 0); }
+void* operator new[](size_t size) { return counted_new(size, 0); }
+void* operator new(size_t size, std::align_val_t align) { return counted_new(size, size_t(align)); }
+void* operator new[](size_t size, std::align_val_t align) { return counted_new(size, size_t(align)); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return counted_alloc(size, 0); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return counted_alloc(size, 0); }
+void* operator new(size_t size, std::align_val_t align, const std::nothrow_t&) noexcept { return counted_alloc(size, size_t(align)); }
+void* operator new[](size_t size, std::align_val_t align, const std::nothrow_t&) noexcept { return counted_alloc(size, size_t(align)); }
+
+void operator delete(void* ptr) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr) noexcept { counted_free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { counted_free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { counted_free(ptr); }
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept { counted_free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { counted_free(ptr); }
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { counted_free(ptr); }
+
+
+// One scripted input command, held for a number of simulation ticks
+struct PathStep
+{
+    int turn;
+    int walk;
+    size_t ticks;
+};
+
+
+struct BenchOptions
+{
+    size_t frames = 500;
+    size_t warmup = 20;
+    size_t width  = 1024;
+    size_t height = 512;
+    std::string assets_dir = "..";
+    std::string path_file  = "../bench/camera_path.txt";
+    std::string replay_file;       // Input recording to drive the player instead of the camera path
+    std::vector<RayCaster> casters = {RayCaster::dda};
+    std::vector<size_t> threads    = {0};
+    std::vector<BlitIsa> isas      = {best_blit_isa()};
+    std::vector<TextureLayout> layouts = {TextureLayout::column_major};
+    std::vector<bool> mipmaps      = {true};
+    std::vector<bool> skip_empty   = {true};
+    std::vector<bool> cull         = {true};
+    std::vector<bool> pvs          = {false};
+    VisibilitySettings visibility;     // Potentially visible sets for --pvs and --pvs-bench
+    std::vector<bool> floors       = {true};
+    std::vector<bool> lighting     = {true};
+    std::vector<bool> specialize   = {true};
+    std::vector<size_t> depths     = {0};
+    std::vector<double> scales     = {1};
+    double target_ms = 0;          // Adaptive 3D view resolution aiming at this render time when not 0
+    std::string map_file;          // Level to render instead of the built-in one
+    size_t gen_map = 0;            // Render a generated gen_map x gen_map level when not 0
+    bool distance_field = false;
+    double max_ray_dist = 20;
+    size_t sprites = 0;    // Replace the five monsters with this many random ones when not 0
+    bool kernels = false;  // Only run the column kernel micro-benchmark
+    bool ray_math = false; // Only run the per-column ray direction micro-benchmark
+    size_t map_bench = 0;  // Only measure map load time and memory for a generated level of this size
+    size_t texture_bench = 0;  // Only measure texture load time for a generated atlas of this many textures
+    std::vector<size_t> agent_bench;  // Only measure monster ticks, for each of these monster counts
+    std::vector<size_t> flow_bench;   // Only measure flow field rebuilds, on generated maps of these sizes
+    std::vector<size_t> pvs_bench;    // Only measure potentially visible set builds, on generated maps of these sizes
+    bool checksum = false;
+    std::string ppm_dir;   // Dump every frame as PPM when not empty
+    std::string y4m_file;  // Stream every frame to one y4m file when not empty
+    bool profile = false;  // Print the mean time of every profiler zone per configuration
+    std::string trace_file;  // Write a Chrome trace of the last configuration when not empty
+};
+
+
+// One point of the sweep over the option lists
+struct BenchConfig
+{
+    size_t threads;
+    BlitIsa isa;
+    TextureLayout layout;
+    bool mipmaps;
+    bool skip_empty;
+    bool cull;
+    bool pvs;
+    bool floors;
+    bool lighting;
+    bool specialize;   // Kernels compiled for the texture sizes in use rather than the generic ones
+    size_t depth;      // Frames in flight through a FramePipeline, 0 = render only, nothing presented
+    double scale;      // 3D view resolution relative to the frame
+    RayCaster caster;
+};
+
+
+struct BenchResult
+{
+    std::vector<double> frame_ms;
+    uint64_t checksum;
+    size_t allocations;    // Heap allocations inside the measured frames
+    bool has_cache_misses;
+    uint64_t cache_misses; // Hardware cache misses inside the measured frames, when perf events are available
+    size_t texture_bytes;  // Memory held by the wall and monster textures
+    bool has_latency;      // Presented through a pipeline: submit to present times
+    double mean_latency_ms;
+    double max_latency_ms;
+    double scale_sum;      // Render scale summed over the measured frames
+    double floor_ms_sum;   // Floor and ceiling time summed over the measured frames
+};
+
+
+static void usage()
+{
+    std::cerr << "usage: bench [options]\n"
+                 "  --frames N        frames to render per configuration (default 500)\n"
+                 "  --warmup N        untimed frames before measuring (default 20)\n"
+                 "  --size WxH        framebuffer size (default 1024x512)\n"
+                 "  --assets DIR      directory holding walltext.bmp and monsters.bmp (default ..)\n"
+                 "  --path FILE       camera path script (default ../bench/camera_path.txt)\n"
+                 "  --replay FILE     drive the player with an input recording (bin/app --record) instead\n"
+                 "  --caster LIST     comma separated ray casters: dda,march (default dda)\n"
+                 "  --threads LIST    comma separated render thread counts, 0 = hardware (default 0)\n"
+                 "  --scaling         shorthand for --threads 1,2,4,8\n"
+                 "  --isa LIST        comma separated column kernels: scalar,sse2,avx2 (default best supported)\n"
+                 "  --layout LIST     comma separated texture layouts: atlas,column (default column)\n"
+                 "  --mipmaps LIST    comma separated on,off (default on, needs the column layout)\n"
+                 "  --map FILE        render a text or binary map file instead of the built-in level\n"
+                 "  --gen-map N       render a generated NxN level instead of the built-in level\n"
+                 "  --field           build the map distance field (enables empty space skipping)\n"
+                 "  --skip LIST       comma separated on,off: DDA empty space skipping (default on)\n"
+                 "  --max-dist D      maximum ray length in cells (default 20)\n"
+                 "  --sprites N       render N randomly placed monsters instead of the usual five\n"
+                 "  --cull LIST       comma separated on,off: sprite grid and view cone culling (default on)\n"
+                 "  --pvs LIST        comma separated on,off: potentially visible sets, built once for the map,\n"
+                 "                    skip hidden sprites (default off)\n"
+                 "  --pvs-region N    cells per side of the potentially visible set regions (default 8)\n"
+                 "  --pvs-range N     range of the potentially visible sets in cells (default 32)\n"
+                 "  --floors LIST     comma separated on,off: textured floor and ceiling (default on)\n"
+                 "  --lighting LIST   comma separated on,off: distance shading through 16 shaded texture copies (default on)\n"
+                 "  --specialize LIST comma separated on,off: wall and sprite kernels compiled for the texture\n"
+                 "                    size and features in use, or the generic ones (default on)\n"
+                 "  --depth LIST      comma separated present pipeline depths, frames are then uploaded to a\n"
+                 "                    hidden window; 0 = render only (default 0)\n"
+                 "  --scale LIST      comma separated 3D view resolutions relative to the frame, e.g. 1,0.5 (default 1)\n"
+                 "  --target-ms T     adapt the 3D view resolution every frame to render in T ms\n"
+                 "  --map-bench N     measure load time and memory of a generated NxN map instead of frames\n"
+                 "  --texture-bench N measure cold and warm load time of a generated atlas of N 256px textures\n"
+                 "  --agent-bench LIST measure monster simulation ticks for each comma separated monster count,\n"
+                 "                    e.g. 1000,10000,100000, on the --gen-map level (default 512)\n"
+                 "  --flow-bench LIST measure flow field rebuilds on generated maps of each comma separated size,\n"
+                 "                    e.g. 1024,2048,4096, and on the --map level when given\n"
+                 "  --pvs-bench LIST  measure potentially visible set builds, cache loads and memory on generated\n"
+                 "                    maps of each comma separated size, and on the --map level when given\n"
+                 "  --kernels         measure column kernel throughput instead of whole frames\n"
+                 "  --ray-math        measure per-frame ray direction setup, per-column trig vs table\n"
+                 "  --checksum        print a checksum of every rendered frame\n"
+                 "  --ppm DIR         dump every rendered frame to DIR/frame_NNNNNN.ppm\n"
+                 "  --y4m FILE        stream every rendered frame to a y4m video file\n"
+                 "  --profile         print the mean time per frame of every profiler zone\n"
+                 "  --trace FILE      write a Chrome trace of the last frames to FILE\n";
+}
+
+
+static std::vector<std::string> split(const std::string& list, const char sep)
+{
+    std::vector<std::string> items;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, sep))
+        if (!item.empty()) items.push_back(item);
+    return items;
+}
+
+
+static bool parse_options(int argc, char** argv, BenchOptions& opt)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool has_value = (i + 1 < argc);
+
+        if (arg == "--frames" && has_value)       opt.frames = std::stoul(argv[++i]);
+        else if (arg == "--warmup" && has_value)  opt.warmup = std::stoul(argv[++i]);
+        else if (arg == "--assets" && has_value)  opt.assets_dir = argv[++i];
+        else if (arg == "--path" && has_value)    opt.path_file = argv[++i];
+        else if (arg == "--replay" && has_value)  opt.replay_file = argv[++i];
+        else if (arg == "--ppm" && has_value)     opt.ppm_dir = argv[++i];
+        else if (arg == "--y4m" && has_value)     opt.y4m_file = argv[++i];
+        else if (arg == "--checksum")             opt.checksum = true;
+        else if (arg == "--profile")              opt.profile = true;
+        else if (arg == "--trace" && has_value)   opt.trace_file = argv[++i];
+        else if (arg == "--scaling")              opt.threads = {1, 2, 4, 8};
+        else if (arg == "--size" && has_value)
+        {
+            std::vector<std::string> wh = split(argv[++i], 'x');
+            if (wh.size() != 2) return false;
+            opt.width  = std::stoul(wh[0]);
+            opt.height = std::stoul(wh[1]);
+        }
+        else if (arg == "--caster" && has_value)
+        {
+            opt.casters.clear();
+            for (const std::string& name : split(argv[++i], ','))
+            {
+                if (name == "dda")        opt.casters.push_back(RayCaster::dda);
+                else if (name == "march") opt.casters.push_back(RayCaster::march);
+                else return false;
+            }
+        }
+        else if (arg == "--kernels")              opt.kernels = true;
+        else if (arg == "--ray-math")             opt.ray_math = true;
+        else if (arg == "--map" && has_value)     opt.map_file = argv[++i];
+        else if (arg == "--gen-map" && has_value) opt.gen_map = std::stoul(argv[++i]);
+        else if (arg == "--field")                opt.distance_field = true;
+        else if (arg == "--max-dist" && has_value) opt.max_ray_dist = std::stod(argv[++i]);
+        else if (arg == "--map-bench" && has_value) opt.map_bench = std::stoul(argv[++i]);
+        else if (arg == "--texture-bench" && has_value) opt.texture_bench = std::stoul(argv[++i]);
+        else if (arg == "--agent-bench" && has_value)
+        {
+            for (const std::string& n : split(argv[++i], ','))
+                opt.agent_bench.push_back(std::stoul(n));
+        }
+        else if (arg == "--flow-bench" && has_value)
+        {
+            for (const std::string& n : split(argv[++i], ','))
+                opt.flow_bench.push_back(std::stoul(n));
+        }
+        else if (arg == "--pvs-bench" && has_value)
+        {
+            for (const std::string& n : split(argv[++i], ','))
+                opt.pvs_bench.push_back(std::stoul(n));
+        }
+        else if (arg == "--sprites" && has_value) opt.sprites = std::stoul(argv[++i]);
+        else if (arg == "--cull" && has_value)
+        {
+            opt.cull.clear();
+            for (const std::string& name : split(argv[++i], ','))
+            {
+                if (name == "on")       opt.cull.push_back(true);
+                else if (name == "off") opt.cull.push_back(false);
+                else return false;
+            }
+        }
+        else if (arg == "--pvs-region" && has_value) opt.visibility.region_size = std::stoul(argv[++i]);
+        else if (arg == "--pvs-range" && has_value)  opt.visibility.max_dist = std::stoul(argv[++i]);
+        else if (arg == "--pvs" && has_value)
+        {
+            opt.pvs.clear();
+            for (const std::string& name : split(argv[++i], ','))
+            {
+                if (name == "on")       opt.pvs.push_back(true);
+                else if (name == "off") opt.pvs.push_back(false);
+                else return false;
+            }
+        }
+        else if (arg == "--lighting" && has_value)
+        {
+            opt.lighting.clear();
+            for (const std::string& name : split(argv[++i], ','))
+            {
+                if (name == "on")       opt.lighting.push_back(true);
+                else if (name == "off") opt.lighting.push_back(false);
+                else return false;
+            }
+        }
+        else if (arg == "--specialize" && has_value)
+        {
+            opt.specialize.clear();
+            for (const std::string& name : split(argv[++i], ','))
+            {
+                if (name == "on")       opt.specialize.push_back(true);
+                else if (name == "off") opt.specialize.push_back(false);
+                else return false;
+            }
+        }
+        else if (arg == "--floors" && has_value)
+        {
+            opt.floors.clear();
+            for (const std::string& name : split(argv[++i], ','))
+            {
+                if (name == "on")       opt.floors.push_back(true);
+                else if (name == "off") opt.floors.push_back(false);
+                else return false;
+            }
+        }
+        else if (arg == "--skip" && has_value)
+        {
+            opt.skip_empty.clear();
+            for (const std::string& name : split(argv[++i], ','))
+            {
+                if (name == "on")       opt.skip_empty.push_back(true);
+                else if (name == "off") opt.skip_empty.push_back(false);
+                else return false;
+            }
+        }
+        else if (arg == "--layout" && has_value)
+        {
+            opt.layouts.clear();
+            for (const std::string& name : split(argv[++i], ','))
+            {
+                if (name == "atlas")       opt.layouts.push_back(TextureLayout::atlas);
+                else if (name == "column") opt.layouts.push_back(TextureLayout::column_major);
+                else return false;
+            }
+        }
+        else if (arg == "--isa" && has_value)
+        {
+            opt.isas.clear();
+            for (const std::string& name : split(argv[++i], ','))
+            {
+                BlitIsa isa = BlitIsa::scalar;
+                if (name == "sse2")        isa = BlitIsa::sse2;
+                else if (name == "avx2")   isa = BlitIsa::avx2;
+                else if (name != "scalar") return false;
+
+                if (!blit_isa_supported(isa))
+                {
+                    std::cerr << "Column kernels " << name << " are not supported on this CPU" << std::endl;
+                    return false;
+                }
+                opt.isas.push_back(isa);
+            }
+        }
+        else if (arg == "--mipmaps" && has_value)
+        {
+            opt.mipmaps.clear();
+            for (const std::string& name : split(argv[++i], ','))
+            {
+                if (name == "on")       opt.mipmaps.push_back(true);
+                else if (name == "off") opt.mipmaps.push_back(false);
+                else return false;
+            }
+        }
+        else if (arg == "--depth" && has_value)
+        {
+            opt.depths.clear();
+            for (const std::string& n : split(argv[++i], ','))
+                opt.depths.push_back(std::stoul(n));
+        }
+        else if (arg == "--scale" && has_value)
+        {
+            opt.scales.clear();
+            for (const std::string& n : split(argv[++i], ','))
+                opt.scales.push_back(std::stod(n));
+        }
+        else if (arg == "--target-ms" && has_value) opt.target_ms = std::stod(argv[++i]);
+        else if (arg == "--threads" && has_value)
+        {
+            opt.threads.clear();
+            for (const std::string& n : split(argv[++i], ','))
+                opt.threads.push_back(std::stoul(n));
+        }
+        else return false;
+    }
+
+    return !opt.casters.empty() && !opt.threads.empty() && !opt.isas.empty() && !opt.layouts.empty()
+           && !opt.mipmaps.empty() && !opt.skip_empty.empty() && !opt.cull.empty() && !opt.pvs.empty() && !opt.floors.empty() && !opt.lighting.empty() && !opt.specialize.empty() && !opt.depths.empty() && !opt.scales.empty() && opt.frames > 0
+           && (!opt.gen_map || opt.gen_map >= 16) && (!opt.map_bench || opt.map_bench >= 16)
+           && std::find(opt.agent_bench.begin(), opt.agent_bench.end(), 0) == opt.agent_bench.end()
+           && std::all_of(opt.flow_bench.begin(), opt.flow_bench.end(), [](const size_t n) { return n >= 16; })
+           && std::all_of(opt.pvs_bench.begin(), opt.pvs_bench.end(), [](const size_t n) { return n >= 16; });
+}
+
+
+// Shortest decimal form, for labels
+static std::string format_number(const double value)
+{
+    std::ostringstream ss;
+    ss << value;
+    return ss.str();
+}
+
+
+static bool load_path(const std::string& filename, std::vector<PathStep>& path)
+{
+    std::ifstream ifs(filename);
+    if (!ifs)
+    {
+        std::cerr << "Error: cannot open camera path " << filename << std::endl;
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(ifs, line))
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream ls(line);
+        PathStep step;
+        if (ls >> step.turn >> step.walk >> step.ticks)
+            path.push_back(step);
+    }
+
+    if (path.empty())
+    {
+        std::cerr << "Error: camera path " << filename << " holds no steps" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+static GameState make_game_state(const std::string& assets_dir, const Map& map, const TextureOptions& texture_options)
+{
+    std::vector<Texture> textures = load_textures({assets_dir + "/walltext.bmp", assets_dir + "/monsters.bmp"},
+                                                  SDL_PIXELFORMAT_ABGR8888, texture_options);
+    return GameState{ map,
+                      Player{3.456, 2.345, 1.523, M_PI/3., 0, 0},
+                      MonsterSystem({ {3.523, 3.812, 2},  // Same monsters as main.cpp
+                                      {1.834, 8.765, 0},
+                                      {5.323, 5.365, 1},
+                                      {14.32, 13.36, 3},
+                                      {4.123, 10.76, 1} }),
+                      std::move(textures[0]),
+                      std::move(textures[1]),
+                      Visibility()};  // Set per configuration, for --pvs on
+}
+
+
+// FNV-1a over the frame's pixels
+static uint64_t frame_checksum(const FrameBuffer& frame_buf)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t j = 0; j < frame_buf.height(); j++)
+    {
+        const uint32_t* row = frame_buf.pixel_ptr(0, j);
+        for (size_t i = 0; i < frame_buf.width(); i++)
+        {
+            hash ^= row[i];
+            hash *= 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+
+static std::vector<BenchConfig> build_configs(const BenchOptions& opt)
+{
+    std::vector<BenchConfig> configs;
+    for (size_t threads : opt.threads)
+        for (BlitIsa isa : opt.isas)
+            for (TextureLayout layout : opt.layouts)
+                for (bool mipmaps : opt.mipmaps)
+                    for (bool skip_empty : opt.skip_empty)
+                        for (bool cull : opt.cull)
+                            for (bool pvs : opt.pvs)
+                                for (bool floors : opt.floors)
+                                    for (bool lighting : opt.lighting)
+                                        for (bool specialize : opt.specialize)
+                                            for (size_t depth : opt.depths)
+                                                for (double scale : opt.scales)
+                                                    for (RayCaster caster : opt.casters)
+                                                        configs.push_back(BenchConfig{threads, isa, layout, mipmaps, skip_empty, cull,
+                                                                                      pvs, floors, lighting, specialize, depth, scale,
+                                                                                      caster});
+    return configs;
+}
+
+
+static std::string config_label(const BenchConfig& config, const Renderer& renderer, const double target_ms)
+{
+    std::ostringstream label;
+    label << (config.caster == RayCaster::dda ? "dda" : "march")
+          << " " << blit_isa_name(config.isa)
+          << " " << (config.layout == TextureLayout::atlas ? "atlas" : "column")
+          << (config.mipmaps ? " mip" : "")
+          << (config.skip_empty ? "" : " noskip")
+          << (config.cull ? "" : " nocull")
+          << (config.pvs ? " pvs" : "")
+          << (config.floors ? "" : " nofloors")
+          << (config.lighting ? "" : " nolight")
+          << (config.specialize ? "" : " generic")
+          << (config.depth ? " depth=" + std::to_string(config.depth) : "")
+          << (config.scale != 1 ? " scale=" + format_number(config.scale) : "")
+          << (target_ms > 0 ? " target=" + format_number(target_ms) + "ms" : "")
+          << " threads=" << renderer.thread_count();
+    return label.str();
+}
+
+
+// Replay the camera path from the start and time every frame
+static BenchResult run_config(const BenchOptions& opt, const std::vector<PathStep>& path, const Map& map,
+                              const Visibility& visibility, const BenchConfig& config, SDL_Renderer* sdl_renderer,
+                              std::string& label)
+{
+    select_blit_isa(config.isa);
+    TextureOptions texture_options;
+    texture_options.layout = config.layout;
+    texture_options.mipmaps = config.mipmaps;
+    texture_options.shade_levels = config.lighting ? 16 : 1;
+    GameState game_state = make_game_state(opt.assets_dir, map, texture_options);
+    if (opt.sprites)
+        game_state.monsters = MonsterSystem(generate_sprites(map, opt.sprites, game_state.texture_monster.texture_count()));
+    if (config.pvs) game_state.visibility = visibility;
+    FrameBuffer frame_buf(opt.width, opt.height, pack_colour(255, 255, 255));
+    BenchResult result{{}, 14695981039346656037ull, 0, false, 0,
+                       game_state.texture_walls.memory_bytes() + game_state.texture_monster.memory_bytes(), false, 0, 0, 0, 0};
+    result.frame_ms.reserve(opt.frames);
+
+    // Opened before the renderer so its worker threads inherit the counter
+    PerfCounter cache_misses;
+    result.has_cache_misses = cache_misses.open(PERF_COUNT_HW_CACHE_MISSES);
+
+    RenderSettings settings;
+    settings.ray_caster = config.caster;
+    settings.thread_count = config.threads;
+    settings.skip_empty = config.skip_empty;
+    settings.cull_sprites = config.cull;
+    settings.pvs = config.pvs;
+    settings.floors = config.floors;
+    settings.lighting = config.lighting;
+    settings.specialize = config.specialize;
+    settings.max_ray_dist = opt.max_ray_dist;
+    settings.render_scale = config.scale;
+    settings.target_ms = opt.target_ms;
+    Renderer renderer(settings);
+    ThreadPool monster_pool(config.threads);
+    FlowField flow(false);  // Rebuilt within the tick, so every run moves the monsters the same way
+    label = config_label(config, renderer, opt.target_ms);
+
+    // Every frame is kept: the writer thread holds the render loop back rather than drop any
+    std::unique_ptr<FrameCapture> capture;
+    if (!opt.ppm_dir.empty() || !opt.y4m_file.empty())
+    {
+        CaptureSettings capture_settings;
+        capture_settings.format = opt.y4m_file.empty() ? CaptureFormat::ppm : CaptureFormat::y4m;
+        capture_settings.lossless = true;
+        capture.reset(new FrameCapture(opt.y4m_file.empty() ? opt.ppm_dir : opt.y4m_file, opt.width, opt.height,
+                                       capture_settings));
+    }
+
+    // Checksum and capture measured frame n, on whichever thread rendered it
+    auto record = [&](const size_t n, const FrameBuffer& frame_buf)
+    {
+        result.scale_sum += renderer.render_scale();
+        result.floor_ms_sum += renderer.floor_ms();
+
+        if (opt.checksum)
+        {
+            uint64_t hash = frame_checksum(frame_buf);
+            result.checksum = (result.checksum ^ hash) * 1099511628211ull;
+            std::cout << label << " frame " << n << " checksum " << std::hex << std::setw(16)
+                      << std::setfill('0') << hash << std::dec << std::setfill(' ') << "\n";
+        }
+
+        if (capture) capture->push(frame_buf);
+    };
+
+    // With a pipeline the render thread draws per-slot snapshots while this thread presents
+    std::vector<Player> cameras(std::max<size_t>(config.depth, 1));
+    std::vector<std::vector<Sprite>> snapshots(cameras.size());
+    std::vector<size_t> frame_of(cameras.size());
+    std::unique_ptr<FramePipeline> pipeline;
+    if (config.depth)
+    {
+        pipeline.reset(new FramePipeline(sdl_renderer, opt.width, opt.height, config.depth,
+                                         [&](FrameBuffer& slot_buf, const size_t slot)
+        {
+            renderer.render(slot_buf, game_state, cameras[slot], snapshots[slot]);
+            if (frame_of[slot] >= opt.warmup) record(frame_of[slot] - opt.warmup, slot_buf);
+        }));
+    }
+
+    Input replay;
+    const bool replaying = !opt.replay_file.empty() && replay.load_replay(opt.replay_file);
+    size_t step = 0;
+    size_t tick_in_step = 0;
+
+    for (size_t frame = 0; frame < opt.warmup + opt.frames; frame++)
+    {
+        const size_t allocs_before = g_alloc_count.load(std::memory_order_relaxed);
+
+        // One simulation tick per frame, as recorded or as scripted by the camera path
+        if (replaying)
+        {
+            replay.apply(game_state.player);
+        }
+        else
+        {
+            game_state.player.turn = path[step].turn;
+            game_state.player.walk = path[step].walk;
+            if (++tick_in_step >= path[step].ticks)
+            {
+                tick_in_step = 0;
+                step = (step + 1) % path.size();
+            }
+        }
+        update_player_position(game_state);
+        flow.update(game_state.map, size_t(game_state.player.x_pos), size_t(game_state.player.y_pos));
+        game_state.monsters.update(game_state.map, game_state.player, monster_pool, &flow);
+
+        if (frame >= opt.warmup) cache_misses.enable();
+        auto t1 = std::chrono::high_resolution_clock::now();
+        if (pipeline)
+        {
+            // Time to hand over the frame: the main thread's share once the pipeline is full
+            const size_t slot = pipeline->next_slot();
+            cameras[slot] = game_state.player;
+            game_state.monsters.sprites(snapshots[slot]);
+            frame_of[slot] = frame;
+            pipeline->submit();
+        }
+        else
+        {
+            renderer.render(frame_buf, game_state);
+        }
+        auto t2 = std::chrono::high_resolution_clock::now();
+        cache_misses.disable();
+        Profiler::instance().end_frame();
+
+        if (frame < opt.warmup) continue;
+        result.allocations += g_alloc_count.load(std::memory_order_relaxed) - allocs_before;
+        result.frame_ms.push_back(std::chrono::duration<double, std::milli>(t2 - t1).count());
+
+        if (!pipeline) record(frame - opt.warmup, frame_buf);
+    }
+
+    if (pipeline)
+    {
+        pipeline->flush();
+        result.has_latency = true;
+        result.mean_latency_ms = pipeline->stats().mean_latency_ms;
+        result.max_latency_ms = pipeline->stats().max_latency_ms;
+    }
+
+    // Textures of a size without kernels of their own, or make SPECIALIZE=0, fall back to the generic ones
+    if (config.specialize && !renderer.specialized()) label += " (some generic kernels)";
+
+    result.cache_misses = cache_misses.value();
+    return result;
+}
+
+
+// Time per column of Texture::copy_scaled_column, generic against specialised for 64px textures,
+// scaling the monster texture columns to a few heights into a framebuffer column. Short columns are
+// mostly setup, which is what the specialised version saves.
+static void bench_texture_columns(const BenchOptions& opt)
+{
+    const Texture texture(opt.assets_dir + "/monsters.bmp", SDL_PIXELFORMAT_ABGR8888);
+    if (texture.texture_size() != 64)
+    {
+        std::cerr << "Error: the texture column benchmark needs the 64px monster texture" << std::endl;
+        return;
+    }
+
+    const size_t columns = std::max<size_t>(opt.frames, 1) * 2000;
+    const size_t pitch = opt.width + 16;  // Padded as the renderer pads its view rows
+    std::vector<uint32_t> dst(512 * pitch);
+
+    for (bool alpha_test : {false, true})
+    for (size_t height : {size_t(8), size_t(32), size_t(128), size_t(512)})
+    for (bool specialize : {false, true})
+    {
+#ifdef NO_SPECIALIZED_KERNELS
+        if (specialize) continue;
+#endif
+        const size_t level = texture.mip_level(height);
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+        for (size_t c = 0; c < columns; c++)
+        {
+            const size_t texture_id = c % texture.texture_count();
+            const size_t texture_coord = (c * 7) % 64;
+            uint32_t* out = &dst[c % opt.width];
+#ifndef NO_SPECIALIZED_KERNELS
+            if (specialize)
+            {
+                if (alpha_test)
+                    texture.copy_scaled_column<6, true>(texture_id, texture_coord, height, 0, height, out, pitch, level);
+                else
+                    texture.copy_scaled_column<6, false>(texture_id, texture_coord, height, 0, height, out, pitch, level);
+                continue;
+            }
+#endif
+            texture.copy_scaled_column(texture_id, texture_coord, height, 0, height, out, pitch, alpha_test, level);
+        }
+        auto t2 = std::chrono::high_resolution_clock::now();
+
+        const double ns = std::chrono::duration<double, std::nano>(t2 - t1).count();
+        std::cout << std::left << std::setw(12) << (specialize ? "specialized" : "generic")
+                  << std::setw(12) << (alpha_test ? "alpha_test" : "copy")
+                  << "height " << std::setw(5) << height << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(8) << ns / columns << " ns/column" << std::endl;
+    }
+}
+
+
+// Throughput of every supported column kernel magnifying a synthetic 64px texture column to
+// 512 rows. The source is read from a 384px wide atlas (stride 384) or a column-major copy
+// (stride 1); the destination is contiguous or strided like a framebuffer column.
+static void bench_kernels(const BenchOptions& opt)
+{
+    const size_t texture_size = 64;
+    const size_t atlas_w = 384;
+    const size_t rows = 512;
+    const size_t repeats = std::max<size_t>(opt.frames, 1) * 200;
+
+    std::vector<uint32_t> atlas(atlas_w * texture_size);
+    for (size_t k = 0; k < atlas.size(); k++)
+        atlas[k] = pack_colour(k, k >> 3, k >> 6, (k * 37) % 256);  // Roughly half the texels pass the alpha test
+
+    std::vector<uint32_t> dst(rows * opt.width);
+
+    for (BlitIsa isa : {BlitIsa::scalar, BlitIsa::sse2, BlitIsa::avx2})
+    {
+        if (!blit_isa_supported(isa)) continue;
+        const BlitKernels& kernels = blit_kernels(isa);
+
+        for (bool alpha_test : {false, true})
+        {
+            for (size_t src_stride : {atlas_w, size_t(1)})
+            for (size_t dst_stride : {size_t(1), opt.width})
+            {
+                ColumnSpan span;
+                span.src        = &atlas[5];
+                span.src_stride = src_stride;
+                span.dst        = dst.data();
+                span.dst_stride = dst_stride;
+                span.count      = rows;
+                setup_column_span(span, texture_size, rows, 0);
+
+                ColumnKernel kernel = alpha_test ? kernels.alpha_test : kernels.copy;
+
+                auto t1 = std::chrono::high_resolution_clock::now();
+                for (size_t r = 0; r < repeats; r++)
+                {
+                    span.src = &atlas[(r % texture_size) * (src_stride == 1 ? texture_size : 1)];
+                    kernel(span);
+                }
+                auto t2 = std::chrono::high_resolution_clock::now();
+
+                const double ns = std::chrono::duration<double, std::nano>(t2 - t1).count();
+                std::cout << std::left << std::setw(8) << blit_isa_name(isa)
+                          << std::setw(12) << (alpha_test ? "alpha_test" : "copy")
+                          << "src_stride " << std::setw(5) << src_stride
+                          << "dst_stride " << std::setw(6) << dst_stride << std::right << std::fixed
+                          << std::setprecision(3) << std::setw(8) << double(rows * repeats) / ns << " px/ns" << std::endl;
+            }
+        }
+    }
+
+    bench_texture_columns(opt);
+}
+
+
+// Cost per frame of the ray directions and fisheye factors of every 3D view column: three trig
+// calls per column as the renderer used to do, against rotating a ColumnRay table built once
+static void bench_ray_math(const BenchOptions& opt)
+{
+    const size_t view_w = opt.width / 2;
+    const size_t frames = std::max<size_t>(opt.frames, 1) * 20;
+    const double fov = M_PI/3.;
+
+    std::vector<ColumnRay> table(view_w);
+    for (size_t i = 0; i < view_w; i++)
+    {
+        const double offset = -fov/2 + fov*i/double(view_w);
+        table[i] = ColumnRay{cos(offset), sin(offset), tan(offset)};
+    }
+
+    // Directions vary per frame so nothing is hoisted out of the frame loop
+    for (bool use_table : {false, true})
+    {
+        double sum = 0;
+        auto t1 = std::chrono::high_resolution_clock::now();
+        for (size_t f = 0; f < frames; f++)
+        {
+            const double direction = 0.001 * double(f);
+            const double dir_cos = cos(direction);
+            const double dir_sin = sin(direction);
+            for (size_t i = 0; i < view_w; i++)
+            {
+                if (use_table)
+                {
+                    const ColumnRay& column = table[i];
+                    sum += dir_cos*column.cos_offset - dir_sin*column.sin_offset;
+                    sum += dir_sin*column.cos_offset + dir_cos*column.sin_offset;
+                    sum += column.cos_offset;
+                }
+                else
+                {
+                    const double angle = direction - fov/2 + fov*i/double(view_w);
+                    sum += cos(angle);
+                    sum += sin(angle);
+                    sum += cos(angle - direction);
+                }
+            }
+        }
+        auto t2 = std::chrono::high_resolution_clock::now();
+
+        const double us = std::chrono::duration<double, std::micro>(t2 - t1).count() / frames;
+        std::cout << std::left << std::setw(16) << (use_table ? "column table" : "per-column trig") << std::right
+                  << std::fixed << std::setprecision(2) << std::setw(8) << us << " us/frame for " << view_w
+                  << " columns" << (sum == 0 ? " (?)" : "") << std::endl;
+    }
+}
+
+
+// Time to load a generated level in each file format and with or without the distance field,
+// and the memory Map keeps per cell in each case
+static void bench_map_load(const BenchOptions& opt)
+{
+    const size_t size = opt.map_bench;
+    const std::filesystem::path dir = std::filesystem::temp_directory_path();
+    const std::string text_file   = (dir / "fps_bench_map.txt").string();
+    const std::string binary_file = (dir / "fps_bench_map.bin").string();
+    const std::string field_file  = (dir / "fps_bench_map_field.bin").string();
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    std::string cells = generate_level(size);
+    auto t2 = std::chrono::high_resolution_clock::now();
+    std::cout << "generated " << size << "x" << size << " level in "
+              << std::chrono::duration<double, std::milli>(t2 - t1).count() << " ms" << std::endl;
+
+    {
+        std::ofstream ofs(text_file);
+        for (size_t j = 0; j < size; j++)
+            ofs.write(&cells[j*size], size) << '\n';
+    }
+    Map(size, size, cells, false).save(binary_file);
+    Map(size, size, cells, true).save(field_file);
+
+    struct Case { const char* name; std::string file; bool field; };
+    const Case cases[] = {
+        {"text",                text_file,   false},
+        {"text + field",        text_file,   true},
+        {"binary (mmap)",       binary_file, false},
+        {"binary + field",      binary_file, true},
+        {"binary field (mmap)", field_file,  false},
+    };
+
+    for (const Case& c : cases)
+    {
+        auto t1 = std::chrono::high_resolution_clock::now();
+        Map map(c.file, c.field);
+        auto t2 = std::chrono::high_resolution_clock::now();
+
+        // Touch every occupancy word so lazily mapped pages are included in the cost
+        size_t walls = 0;
+        for (size_t j = 0; j < map.height(); j++)
+            for (size_t i = 0; i < map.width(); i += 64)
+                walls += !map.is_empty(i, j);
+        auto t3 = std::chrono::high_resolution_clock::now();
+
+        std::cout << std::left << std::setw(22) << c.name << std::right << std::fixed << std::setprecision(2)
+                  << " load " << std::setw(9) << std::chrono::duration<double, std::milli>(t2 - t1).count() << " ms"
+                  << "  first scan " << std::setw(8) << std::chrono::duration<double, std::milli>(t3 - t2).count() << " ms"
+                  << "  " << std::setw(6) << double(map.memory_bytes()) / double(size * size) << " bytes/cell"
+                  << (walls ? "" : " (empty?)") << std::endl;
+    }
+
+    std::filesystem::remove(text_file);
+    std::filesystem::remove(binary_file);
+    std::filesystem::remove(field_file);
+}
+
+
+// Startup cost of textures: decoding and preprocessing a generated atlas, the same while writing
+// the cache (cold start), mapping the cache (warm start), and loading several files one after
+// the other against all at once
+static void bench_texture_load(const BenchOptions& opt)
+{
+    const std::filesystem::path dir = std::filesystem::temp_directory_path() / "fps_bench_textures";
+    const std::string atlas_file = (dir / "atlas.bmp").string();
+    const std::string atlas2_file = (dir / "atlas2.bmp").string();
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+
+    if (!write_texture_atlas(atlas_file, opt.texture_bench, 256) || !write_texture_atlas(atlas2_file, opt.texture_bench, 256, 2))
+        return;
+
+    // Reading every texel once afterwards charges the mapped cache for the page faults it defers
+    auto load_ms = [](const std::string& file, const TextureOptions& options, bool& from_cache, size_t& bytes,
+                      double& touch_ms, uint32_t& sum)
+    {
+        auto t1 = std::chrono::high_resolution_clock::now();
+        Texture texture(file, SDL_PIXELFORMAT_ABGR8888, options);
+        auto t2 = std::chrono::high_resolution_clock::now();
+
+        sum = 0;
+        for (size_t idx = 0; idx < texture.texture_count(); idx++)
+            for (size_t i = 0; i < texture.texture_size(); i++)
+                for (size_t j = 0; j < texture.texture_size(); j++)
+                    sum += texture.get_px_from_texture(i, j, idx);
+        auto t3 = std::chrono::high_resolution_clock::now();
+
+        from_cache = texture.from_cache();
+        bytes = texture.memory_bytes();
+        touch_ms = std::chrono::duration<double, std::milli>(t3 - t2).count();
+        return std::chrono::duration<double, std::milli>(t2 - t1).count();
+    };
+
+    std::cout << opt.texture_bench << " textures of 256x256, " << std::filesystem::file_size(atlas_file) / 1024
+              << " KiB bitmap" << std::endl;
+
+    for (TextureLayout layout : opt.layouts)
+    {
+        for (bool mipmaps : opt.mipmaps)
+        {
+            if (layout == TextureLayout::atlas && mipmaps && opt.mipmaps.size() > 1) continue;
+
+            TextureOptions options;
+            options.layout = layout;
+            options.mipmaps = mipmaps;
+            TextureOptions cached = options;
+            cached.cache_dir = (dir / "cache").string();
+
+            const std::string label = std::string(layout == TextureLayout::atlas ? "atlas" : "column")
+                                    + (layout == TextureLayout::column_major && mipmaps ? " mip" : "");
+
+            struct Case { const char* name; const TextureOptions& options; };
+            const Case cases[] = {
+                {", decode",       options},
+                {", cold",         cached},   // Decodes and writes the cache
+                {", warm",         cached},   // Maps the cache
+            };
+            for (const Case& c : cases)
+            {
+                bool from_cache = false;
+                size_t bytes = 0;
+                double touch_ms = 0;
+                uint32_t sum = 0;
+                const double ms = load_ms(atlas_file, c.options, from_cache, bytes, touch_ms, sum);
+                std::cout << std::left << std::setw(20) << label + c.name << std::right << std::fixed << std::setprecision(2)
+                          << " load " << std::setw(9) << ms << " ms   first read " << std::setw(7) << touch_ms << " ms  "
+                          << std::setw(8) << bytes / 1024 << " KiB"
+                          << (from_cache ? "  from cache" : "") << (sum == 0 ? " (?)" : "") << std::endl;
+            }
+        }
+    }
+
+    TextureOptions options;
+    options.layout = opt.layouts[0];
+    options.mipmaps = opt.mipmaps[0];
+
+    const std::vector<std::string> files = {atlas_file, atlas2_file, opt.assets_dir + "/walltext.bmp", opt.assets_dir + "/monsters.bmp"};
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (const std::string& file : files)
+        Texture(file, SDL_PIXELFORMAT_ABGR8888, options);
+    auto t2 = std::chrono::high_resolution_clock::now();
+    std::vector<Texture> textures = load_textures(files, SDL_PIXELFORMAT_ABGR8888, options);
+    auto t3 = std::chrono::high_resolution_clock::now();
+
+    std::cout << std::left << std::setw(20) << "4 files, one by one" << std::right << " load " << std::setw(9)
+              << std::chrono::duration<double, std::milli>(t2 - t1).count() << " ms" << std::endl
+              << std::left << std::setw(20) << "4 files, threaded" << std::right << " load " << std::setw(9)
+              << std::chrono::duration<double, std::milli>(t3 - t2).count() << " ms  ("
+              << std::thread::hardware_concurrency() << " hardware threads)" << std::endl;
+
+    std::filesystem::remove_all(dir);
+}
+
+
+static double percentile(const std::vector<double>& sorted, const double p)
+{
+    size_t idx = std::min(sorted.size() - 1, size_t(p * (sorted.size() - 1) + 0.5));
+    return sorted[idx];
+}
+
+
+// Flow field rebuilds towards a series of player cells spread over each map: the build on the
+// background thread, and the time update() takes on the tick thread meanwhile
+static void bench_flow_field(const BenchOptions& opt)
+{
+    std::vector<std::pair<std::string, Map>> maps;
+    for (size_t size : opt.flow_bench)
+        maps.emplace_back(std::to_string(size) + "x" + std::to_string(size) + " generated", Map(size, size, generate_level(size)));
+    if (!opt.map_file.empty())
+    {
+        Map map(opt.map_file);
+        if (!map.width()) return;
+        maps.emplace_back(opt.map_file, std::move(map));
+    }
+
+    const size_t rebuilds = std::max<size_t>(1, std::min<size_t>(opt.frames, 20));
+
+    for (const auto& named : maps)
+    {
+        const Map& map = named.second;
+        const std::vector<Sprite> targets = generate_sprites(map, rebuilds, 1);
+        FlowField flow;
+
+        std::vector<double> build_ms;
+        std::vector<double> update_us;
+        size_t reachable = 0;
+        for (const Sprite& target : targets)
+        {
+            auto t1 = std::chrono::high_resolution_clock::now();
+            flow.update(map, size_t(target.x_pos), size_t(target.y_pos));  // Starts the build
+            auto t2 = std::chrono::high_resolution_clock::now();
+            flow.wait();
+            auto t3 = std::chrono::high_resolution_clock::now();
+            flow.update(map, size_t(target.x_pos), size_t(target.y_pos));  // Publishes it
+            auto t4 = std::chrono::high_resolution_clock::now();
+
+            build_ms.push_back(std::chrono::duration<double, std::milli>(t3 - t2).count());
+            update_us.push_back(std::chrono::duration<double, std::micro>(t2 - t1).count());
+            update_us.push_back(std::chrono::duration<double, std::micro>(t4 - t3).count());
+            reachable += flow.reachable();
+        }
+        std::sort(build_ms.begin(), build_ms.end());
+        std::sort(update_us.begin(), update_us.end());
+
+        std::cout << std::left << std::setw(22) << named.first << std::right << std::fixed << std::setprecision(2)
+                  << " rebuild min " << std::setw(7) << build_ms.front() << " ms  median " << std::setw(7)
+                  << percentile(build_ms, 0.5) << " ms   update() median " << std::setw(6) << percentile(update_us, 0.5)
+                  << " us  max " << std::setw(7) << update_us.back() << " us   "
+                  << std::setprecision(1) << 100. * double(reachable) / double(targets.size() * map.width() * map.height())
+                  << "% of cells reachable, " << double(map.width() * map.height() * 3) / (1 << 20) << " MiB per field"
+                  << std::endl;
+    }
+}
+
+
+// Potentially visible sets of each map: the build alone, the build writing the cache (cold start)
+// and mapping the cache (warm start), their memory, and how much of the map around a cell they hide
+static void bench_visibility(const BenchOptions& opt)
+{
+    std::vector<std::pair<std::string, Map>> maps;
+    for (size_t size : opt.pvs_bench)
+        maps.emplace_back(std::to_string(size) + "x" + std::to_string(size) + " generated", Map(size, size, generate_level(size)));
+    if (!opt.map_file.empty())
+    {
+        Map map(opt.map_file);
+        if (!map.width()) return;
+        maps.emplace_back(opt.map_file, std::move(map));
+    }
+
+    const std::filesystem::path dir = std::filesystem::temp_directory_path() / "fps_bench_visibility";
+    VisibilitySettings settings = opt.visibility;
+    settings.thread_count = opt.threads[0];
+    VisibilitySettings cached = settings;
+    cached.cache_dir = dir.string();
+
+    std::cout << "regions of " << settings.region_size << "x" << settings.region_size << ", range " << settings.max_dist
+              << " cells, " << settings.edge_samples << " origins per cell edge x " << settings.rays << " rays, "
+              << ThreadPool(settings.thread_count).thread_count() << " build threads" << std::endl;
+
+    for (const auto& named : maps)
+    {
+        const Map& map = named.second;
+        std::filesystem::remove_all(dir);
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+        const Visibility built(map, settings);
+        auto t2 = std::chrono::high_resolution_clock::now();
+        const Visibility cold(map, cached);
+        auto t3 = std::chrono::high_resolution_clock::now();
+        const Visibility warm(map, cached);
+        auto t4 = std::chrono::high_resolution_clock::now();
+
+        size_t visible = 0;
+        size_t differ = 0;
+        for (size_t j = 0; j < map.height(); j += built.region_size())
+        {
+            for (size_t i = 0; i < map.width(); i += built.region_size())
+            {
+                visible += built.visible_regions(i, j);
+                differ += warm.visible_regions(i, j) != built.visible_regions(i, j);
+            }
+        }
+
+        // From spots spread over the map, the empty cells within --max-dist a sprite could stand in
+        // and the share of them in hidden regions
+        const std::vector<Sprite> spots = generate_sprites(map, 1000, 1);
+        const long range = long(opt.max_ray_dist);
+        size_t near = 0;
+        size_t hidden = 0;
+        for (const Sprite& spot : spots)
+        {
+            const long si = long(spot.x_pos);
+            const long sj = long(spot.y_pos);
+            for (long j = std::max(0L, sj - range); j <= std::min(long(map.height()) - 1, sj + range); j++)
+            {
+                for (long i = std::max(0L, si - range); i <= std::min(long(map.width()) - 1, si + range); i++)
+                {
+                    if ((i - si)*(i - si) + (j - sj)*(j - sj) > range*range || !map.is_empty(i, j)) continue;
+                    near++;
+                    hidden += !built.visible(size_t(si), size_t(sj), size_t(i), size_t(j));
+                }
+            }
+        }
+
+        std::cout << std::left << std::setw(22) << named.first << std::right << std::fixed << std::setprecision(1)
+                  << " build " << std::setw(8) << std::chrono::duration<double, std::milli>(t2 - t1).count() << " ms"
+                  << "  cold " << std::setw(8) << std::chrono::duration<double, std::milli>(t3 - t2).count() << " ms"
+                  << "  warm " << std::setw(6) << std::setprecision(2) << std::chrono::duration<double, std::milli>(t4 - t3).count()
+                  << " ms" << (warm.from_cache() && !differ ? "" : " (not from cache?)")
+                  << "   " << std::setw(7) << std::setprecision(1) << built.memory_bytes() / 1024. << " KiB, "
+                  << std::setprecision(2) << double(built.memory_bytes()) / double(map.width() * map.height()) << " bytes/cell"
+                  << "   " << std::setprecision(1) << double(visible) / double(built.region_count()) << " regions visible"
+                  << "   " << (near ? 100. * double(hidden) / double(near) : 0.) << "% of the cells within "
+                  << range << " hidden" << std::endl;
+    }
+
+    std::filesystem::remove_all(dir);
+}
+
+
+// Monster simulation alone: ticks per second for each monster count and thread count, with the
+// monsters spread over a generated level and the player standing at its start, chased through a
+// flow field built beforehand
+static void bench_monsters(const BenchOptions& opt)
+{
+    const size_t size = opt.gen_map ? opt.gen_map : 512;
+    const Map map(size, size, generate_level(size));
+    const Player player{3.456, 2.345, 1.523, M_PI/3., 0, 0};
+    const size_t texture_count = 4;  // monsters.bmp holds 4 textures
+    FlowField flow(false);
+    flow.update(map, size_t(player.x_pos), size_t(player.y_pos));
+
+    std::cout << size << "x" << size << " map, " << opt.frames << " ticks after " << opt.warmup << " warmup ticks" << std::endl;
+
+    for (size_t count : opt.agent_bench)
+    {
+        const std::vector<Sprite> placed = generate_sprites(map, count, texture_count);
+
+        for (size_t threads : opt.threads)
+        {
+            MonsterSystem monsters(placed);
+            ThreadPool pool(threads);
+            std::vector<Sprite> sprites;
+
+            for (size_t t = 0; t < opt.warmup; t++)
+                monsters.update(map, player, pool, &flow);
+
+            double update_ms = 0;
+            double sprites_ms = 0;
+            for (size_t t = 0; t < opt.frames; t++)
+            {
+                auto t1 = std::chrono::high_resolution_clock::now();
+                monsters.update(map, player, pool, &flow);
+                auto t2 = std::chrono::high_resolution_clock::now();
+                monsters.sprites(sprites);
+                auto t3 = std::chrono::high_resolution_clock::now();
+                update_ms += std::chrono::duration<double, std::milli>(t2 - t1).count();
+                sprites_ms += std::chrono::duration<double, std::milli>(t3 - t2).count();
+            }
+            update_ms /= double(opt.frames);
+            sprites_ms /= double(opt.frames);
+
+            size_t chasing = 0;
+            for (size_t k = 0; k < monsters.size(); k++)
+                chasing += monsters.state(k) == MonsterState::chase;
+
+            std::cout << std::setw(7) << count << " monsters threads=" << std::left << std::setw(3) << pool.thread_count()
+                      << std::right << std::fixed << std::setprecision(3)
+                      << " tick " << std::setw(8) << update_ms << " ms  " << std::setw(10) << std::setprecision(0)
+                      << 1000. / update_ms << " ticks/s  " << std::setprecision(2) << std::setw(6)
+                      << update_ms * 1e6 / double(count) << " ns/monster   sprites " << std::setprecision(3)
+                      << std::setw(7) << sprites_ms << " ms   chasing " << chasing << std::endl;
+        }
+    }
+}
+
+
+static void report(const std::string& label, const BenchResult& result, const BenchOptions& opt)
+{
+    std::vector<double> ms = result.frame_ms;
+    std::sort(ms.begin(), ms.end());
+
+    double total_ms = 0;
+    for (double t : ms) total_ms += t;
+
+    const double pixels = double(opt.width * opt.height) * ms.size();
+    const double mpix_per_s = pixels / (total_ms * 1e-3) * 1e-6;
+
+    std::cout << std::left << std::setw(32) << label << std::right << std::fixed << std::setprecision(3)
+              << " min " << std::setw(8) << ms.front()
+              << "  median " << std::setw(8) << percentile(ms, 0.5)
+              << "  p99 " << std::setw(8) << percentile(ms, 0.99)
+              << " ms   " << std::setprecision(1) << std::setw(8) << mpix_per_s << " Mpx/s"
+              << "   allocs/frame " << std::setprecision(2) << double(result.allocations) / ms.size()
+              << "   textures " << std::setprecision(0) << result.texture_bytes / 1024. << " KiB";
+    if (result.has_latency)
+        std::cout << "   latency mean " << std::setprecision(2) << result.mean_latency_ms
+                  << " max " << result.max_latency_ms << " ms";
+    if (result.floor_ms_sum > 0)
+        std::cout << "   floors " << std::setprecision(3) << result.floor_ms_sum / ms.size() << " ms";
+    if (opt.target_ms > 0)
+        std::cout << "   scale mean " << std::setprecision(2) << result.scale_sum / ms.size();
+    if (result.has_cache_misses)
+        std::cout << "   cache misses/frame " << std::setprecision(0) << double(result.cache_misses) / ms.size();
+    if (opt.checksum)
+        std::cout << "   checksum " << std::hex << std::setw(16) << std::setfill('0') << result.checksum
+                  << std::dec << std::setfill(' ');
+    std::cout << std::endl;
+
+    // Means over the profiler history, i.e. the last measured frames of this configuration
+    const Profiler& profiler = Profiler::instance();
+    if (opt.profile)
+    {
+        std::cout << "   zones ms/frame:" << std::setprecision(3);
+        for (size_t z = 0; z < profiler.zone_count(); z++)
+            std::cout << " " << profiler.zone_name(z) << " " << profiler.zone_ms(z);
+        std::cout << std::endl;
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    BenchOptions opt;
+    if (!parse_options(argc, argv, opt))
+    {
+        usage();
+        return 1;
+    }
+
+    if (opt.kernels)
+    {
+        bench_kernels(opt);
+        return 0;
+    }
+
+    if (opt.map_bench)
+    {
+        bench_map_load(opt);
+        return 0;
+    }
+
+    if (opt.texture_bench)
+    {
+        bench_texture_load(opt);
+        return 0;
+    }
+
+    if (!opt.flow_bench.empty())
+    {
+        bench_flow_field(opt);
+        return 0;
+    }
+
+    if (!opt.pvs_bench.empty())
+    {
+        bench_visibility(opt);
+        return 0;
+    }
+
+    if (!opt.agent_bench.empty())
+    {
+        bench_monsters(opt);
+        return 0;
+    }
+
+    if (opt.ray_math)
+    {
+        bench_ray_math(opt);
+        return 0;
+    }
+
+    Map map;
+    if (!opt.map_file.empty())
+        map = Map(opt.map_file, opt.distance_field);
+    else if (opt.gen_map)
+        map = Map(opt.gen_map, opt.gen_map, generate_level(opt.gen_map), opt.distance_field,
+                  std::string(opt.gen_map * opt.gen_map, '0'), std::string(opt.gen_map * opt.gen_map, '5'));
+    else if (opt.distance_field)
+        map = Map(true);
+    if (!map.width())
+    {
+        std::cerr << "Failed to load the map" << std::endl;
+        return 1;
+    }
+
+    std::vector<PathStep> path;
+    if (opt.replay_file.empty() && !load_path(opt.path_file, path)) return 1;
+    if (!opt.replay_file.empty() && !Input().load_replay(opt.replay_file)) return 1;
+
+    {
+        GameState probe = make_game_state(opt.assets_dir, map, TextureOptions());
+        if (!probe.texture_walls.texture_count() || !probe.texture_monster.texture_count())
+        {
+            std::cerr << "Failed to load textures from " << opt.assets_dir << std::endl;
+            return 1;
+        }
+        if (!map.validate(probe.texture_walls.texture_count(), probe.player.x_pos, probe.player.y_pos)) return 1;
+    }
+
+    std::cout << opt.frames << " frames at " << opt.width << "x" << opt.height << ", "
+              << (opt.replay_file.empty() ? std::to_string(path.size()) + " path steps, " : "replaying " + opt.replay_file + ", ")
+              << map.width() << "x" << map.height() << " map"
+              << (map.has_distance_field() ? " with distance field" : "")
+              << (opt.sprites ? ", " + std::to_string(opt.sprites) + " sprites" : "") << std::endl;
+
+    // Built once for every configuration using it
+    Visibility visibility;
+    if (std::find(opt.pvs.begin(), opt.pvs.end(), true) != opt.pvs.end())
+    {
+        auto t1 = std::chrono::high_resolution_clock::now();
+        visibility = Visibility(map, opt.visibility);
+        auto t2 = std::chrono::high_resolution_clock::now();
+        std::cout << "potentially visible sets: " << visibility.region_count() << " regions of " << visibility.region_size()
+                  << "x" << visibility.region_size() << ", " << visibility.memory_bytes() / 1024 << " KiB, built in "
+                  << std::fixed << std::setprecision(1) << std::chrono::duration<double, std::milli>(t2 - t1).count()
+                  << " ms" << std::defaultfloat << std::endl;
+    }
+
+    Profiler::instance().set_enabled(opt.profile || !opt.trace_file.empty());
+
+    // A hidden window to present into when a pipeline depth is measured
+    SDL_Window* window = nullptr;
+    SDL_Renderer* sdl_renderer = nullptr;
+    if (std::any_of(opt.depths.begin(), opt.depths.end(), [](const size_t depth) { return depth > 0; }))
+    {
+        if (SDL_Init(SDL_INIT_VIDEO) || SDL_CreateWindowAndRenderer(opt.width, opt.height, SDL_WINDOW_HIDDEN, &window, &sdl_renderer))
+        {
+            std::cerr << "Failed to create a window to present into: " << SDL_GetError() << std::endl;
+            return 1;
+        }
+    }
+
+    for (const BenchConfig& config : build_configs(opt))
+    {
+        std::string label;
+        BenchResult result = run_config(opt, path, map, visibility, config, sdl_renderer, label);
+        report(label, result, opt);
+    }
+
+    if (!opt.trace_file.empty()) Profiler::instance().write_trace(opt.trace_file);
+
+    if (window)
+    {
+        SDL_DestroyRenderer(sdl_renderer);
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+    }
+
+    return 0;
+}
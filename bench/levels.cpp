@@ -0,0 +1,112 @@
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+
+#include "levels.h"
+
+
+// xorshift64*: unlike std:: distributions, identical everywhere
+static uint64_t next_random(uint64_t& state)
+{
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 2685821657736338717ull;
+}
+
+
+std::string generate_level(const size_t size, const uint64_t seed)
+{
+    assert(size >= 16);
+
+    const size_t room = 16;
+    const size_t wall_textures = 6;  // walltext.bmp holds 6 textures
+    uint64_t state = seed * 0x9E3779B97F4A7C15ull + 1;
+    std::string cells(size * size, ' ');
+
+    for (size_t j = 0; j < size; j++)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            bool border  = (i == 0 || j == 0 || i == size - 1 || j == size - 1);
+            bool doorway = (i % room >= 6 && i % room < 10) || (j % room >= 6 && j % room < 10);
+            bool partition = (i % room == 0 || j % room == 0) && !doorway;
+            bool pillar = (next_random(state) % 100) < 3;
+
+            if (border || partition || pillar)
+                cells[i + j*size] = char('0' + (i / room + j / room) % wall_textures);
+        }
+    }
+
+    for (size_t j = 1; j < 8; j++)
+        for (size_t i = 1; i < 8; i++)
+            cells[i + j*size] = ' ';
+
+    return cells;
+}
+
+
+std::vector<Sprite> generate_sprites(const Map& map, const size_t count, const size_t texture_count, const uint64_t seed)
+{
+    assert(map.width() && map.height() && texture_count);
+
+    uint64_t state = seed * 0x9E3779B97F4A7C15ull + 7;
+    std::vector<Sprite> sprites;
+    sprites.reserve(count);
+
+    while (sprites.size() < count)
+    {
+        size_t i = next_random(state) % map.width();
+        size_t j = next_random(state) % map.height();
+        if (!map.is_empty(i, j)) continue;
+
+        // 1/1024 steps inside the cell, away from its walls
+        double x = i + 0.1 + 0.8 * double(next_random(state) % 1024) / 1024.;
+        double y = j + 0.1 + 0.8 * double(next_random(state) % 1024) / 1024.;
+        sprites.push_back(Sprite{x, y, size_t(next_random(state) % texture_count)});
+    }
+
+    return sprites;
+}
+
+
+bool write_texture_atlas(const std::string& filename, const size_t count, const size_t size, const uint64_t seed)
+{
+    const uint32_t w = uint32_t(count * size);
+    const uint32_t h = uint32_t(size);
+    const uint32_t pixel_bytes = w * h * 4;
+
+    // BITMAPFILEHEADER, then a BITMAPINFOHEADER with negative height: rows top to bottom
+    uint8_t header[54] = {'B', 'M'};
+    auto put32 = [&](const size_t at, const uint32_t value) { std::memcpy(header + at, &value, 4); };
+    put32(2, 54 + pixel_bytes);
+    put32(10, 54);
+    put32(14, 40);
+    put32(18, w);
+    put32(22, uint32_t(-int32_t(h)));
+    header[26] = 1;
+    header[28] = 32;
+    put32(34, pixel_bytes);
+
+    uint64_t state = seed * 0x9E3779B97F4A7C15ull + 1;
+    std::vector<uint8_t> pixels(pixel_bytes);
+    for (size_t k = 0; k < pixels.size(); k += 4)
+    {
+        const uint64_t r = next_random(state);
+        pixels[k + 0] = uint8_t(r);        // BGRA
+        pixels[k + 1] = uint8_t(r >> 8);
+        pixels[k + 2] = uint8_t(r >> 16);
+        pixels[k + 3] = (r >> 24) % 4 ? 255 : 0;
+    }
+
+    std::ofstream ofs(filename, std::ios::binary);
+    ofs.write(reinterpret_cast<const char*>(header), sizeof(header));
+    ofs.write(reinterpret_cast<const char*>(pixels.data()), pixels.size());
+    if (!ofs)
+    {
+        std::cerr << "Error: cannot write " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,25 @@
+#ifndef LEVELS_H
+#define LEVELS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "map.h"
+#include "sprite.h"
+
+
+// Procedural size x size level for benchmarks, as cells in the text map format: a grid of 16x16
+// rooms joined by doorways, scattered pillars and a clear area around the player start (3,2).
+// The same seed gives the same level on every platform.
+std::string generate_level(const size_t size, const uint64_t seed = 1);
+
+// count sprites at random spots in the empty cells of map, with texture ids below texture_count
+std::vector<Sprite> generate_sprites(const Map& map, const size_t count, const size_t texture_count, const uint64_t seed = 1);
+
+// Write a 32 bit BMP atlas of count random size x size textures, roughly a quarter of the texels
+// transparent, for texture loading benchmarks
+bool write_texture_atlas(const std::string& filename, const size_t count, const size_t size, const uint64_t seed = 1);
+
+
+#endif
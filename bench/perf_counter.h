@@ -0,0 +1,81 @@
+#ifndef PERF_COUNTER_H
+#define PERF_COUNTER_H
+
+#include <cstdint>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+
+// Hardware event counter for this process and the threads it starts after open(), read through
+// Linux perf events. Elsewhere, or when the kernel refuses access, available() is false.
+class PerfCounter
+{
+    int m_fd;
+
+public:
+    PerfCounter() : m_fd(-1) {}
+    ~PerfCounter() { close(); }
+
+    PerfCounter(const PerfCounter&) = delete;
+    PerfCounter& operator=(const PerfCounter&) = delete;
+
+    // Event is one of PERF_COUNT_HW_*; the counter starts disabled
+    bool open(const uint64_t event)
+    {
+#ifdef __linux__
+        perf_event_attr attr{};
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = event;
+        attr.disabled = 1;
+        attr.inherit = 1;         // Also count render worker threads created afterwards
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        m_fd = int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#else
+        (void)event;
+#endif
+        return available();
+    }
+
+    void close()
+    {
+#ifdef __linux__
+        if (m_fd >= 0) ::close(m_fd);
+#endif
+        m_fd = -1;
+    }
+
+    bool available() const { return m_fd >= 0; }
+
+    void enable()
+    {
+#ifdef __linux__
+        if (available()) ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+    }
+
+    void disable()
+    {
+#ifdef __linux__
+        if (available()) ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+#endif
+    }
+
+    uint64_t value() const
+    {
+        uint64_t count = 0;
+#ifdef __linux__
+        if (available() && read(m_fd, &count, sizeof(count)) != sizeof(count)) count = 0;
+#endif
+        return count;
+    }
+};
+
+
+#endif
@@ -0,0 +1,241 @@
+#include <cassert>
+#include <algorithm>
+
+#include "blit.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BLIT_X86 1
+#include <immintrin.h>
+#endif
+
+
+// Continue span from output pixel done onwards, so the vector kernels can hand their tail
+// to the scalar ones
+static ColumnSpan span_tail(const ColumnSpan& span, const size_t done)
+{
+    ColumnSpan tail = span;
+    tail.v     = span.v + uint32_t(done) * span.step;
+    tail.dst   = span.dst + done * span.dst_stride;
+    tail.count = span.count - done;
+    return tail;
+}
+
+
+static void copy_scalar(const ColumnSpan& span)
+{
+    uint32_t v = span.v;
+    uint32_t* dst = span.dst;
+
+    for (size_t k = 0; k < span.count; k++)
+    {
+        *dst = span.src[(v >> span.shift) * span.src_stride];
+        dst += span.dst_stride;
+        v += span.step;
+    }
+}
+
+
+static void alpha_test_scalar(const ColumnSpan& span)
+{
+    uint32_t v = span.v;
+    uint32_t* dst = span.dst;
+
+    for (size_t k = 0; k < span.count; k++)
+    {
+        uint32_t colour = span.src[(v >> span.shift) * span.src_stride];
+        if (is_opaque(colour)) *dst = colour;
+        dst += span.dst_stride;
+        v += span.step;
+    }
+}
+
+
+#ifdef BLIT_X86
+
+// SSE2 has no gather, so texels are fetched one by one. The alpha test and the stores are done four
+// pixels at a time when the destination is contiguous; strided destinations gain nothing over scalar.
+template <bool alpha_test>
+static void column_sse2(const ColumnSpan& span)
+{
+    if (span.dst_stride != 1)
+    {
+        alpha_test ? alpha_test_scalar(span) : copy_scalar(span);
+        return;
+    }
+
+    const size_t blocks = span.count / 4;
+    const __m128i threshold = _mm_set1_epi32(128);
+    const uint32_t* src = span.src;
+    const size_t src_stride = span.src_stride;
+    const unsigned shift = span.shift;
+    const uint32_t step = span.step;
+    uint32_t v = span.v;
+    __m128i* out = reinterpret_cast<__m128i*>(span.dst);
+
+    for (size_t b = 0; b < blocks; b++, out++)
+    {
+        uint32_t t0 = src[( v           >> shift) * src_stride];
+        uint32_t t1 = src[((v +   step) >> shift) * src_stride];
+        uint32_t t2 = src[((v + 2*step) >> shift) * src_stride];
+        uint32_t t3 = src[((v + 3*step) >> shift) * src_stride];
+        v += 4*step;
+
+        __m128i colour = _mm_setr_epi32(t0, t1, t2, t3);
+        if (alpha_test)
+        {
+            __m128i mask = _mm_cmpgt_epi32(_mm_srli_epi32(colour, 24), threshold);
+            colour = _mm_or_si128(_mm_and_si128(mask, colour), _mm_andnot_si128(mask, _mm_loadu_si128(out)));
+        }
+        _mm_storeu_si128(out, colour);
+    }
+
+    ColumnSpan tail = span_tail(span, blocks * 4);
+    alpha_test ? alpha_test_scalar(tail) : copy_scalar(tail);
+}
+
+
+// AVX2 gathers eight texels at a time; strided destinations are still written lane by lane
+template <bool alpha_test>
+__attribute__((target("avx2"))) static void column_avx2(const ColumnSpan& span)
+{
+    const size_t blocks = span.count / 8;
+    const __m128i shift = _mm_cvtsi32_si128(span.shift);
+    const __m256i step8 = _mm256_set1_epi32(8 * span.step);
+    const __m256i src_stride = _mm256_set1_epi32(int(span.src_stride));
+    const __m256i threshold = _mm256_set1_epi32(128);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i v = _mm256_add_epi32(_mm256_set1_epi32(span.v), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(span.step)));
+    uint32_t* dst = span.dst;
+
+    alignas(32) uint32_t px[8];
+
+    for (size_t b = 0; b < blocks; b++)
+    {
+        __m256i offset = _mm256_mullo_epi32(_mm256_srl_epi32(v, shift), src_stride);
+        __m256i colour = _mm256_i32gather_epi32(reinterpret_cast<const int*>(span.src), offset, 4);
+        v = _mm256_add_epi32(v, step8);
+
+        __m256i mask = _mm256_set1_epi32(-1);
+        if (alpha_test)
+            mask = _mm256_cmpgt_epi32(_mm256_srli_epi32(colour, 24), threshold);
+
+        if (span.dst_stride == 1)
+        {
+            if (alpha_test)
+                _mm256_maskstore_epi32(reinterpret_cast<int*>(dst), mask, colour);
+            else
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), colour);
+        }
+        else
+        {
+            _mm256_store_si256(reinterpret_cast<__m256i*>(px), colour);
+            int opaque = _mm256_movemask_ps(_mm256_castsi256_ps(mask));
+            for (int k = 0; k < 8; k++)
+                if (opaque & (1 << k)) dst[k * span.dst_stride] = px[k];
+        }
+
+        dst += 8 * span.dst_stride;
+    }
+
+    ColumnSpan tail = span_tail(span, blocks * 8);
+    alpha_test ? alpha_test_scalar(tail) : copy_scalar(tail);
+}
+
+#endif
+
+
+void setup_column_span(ColumnSpan& span, const size_t texture_size, const size_t out_size, const size_t first)
+{
+    assert(texture_size > 0 && out_size > 0);
+
+    // Leave one bit of headroom above the largest texel index so v never wraps
+    unsigned int_bits = 1;
+    while ((size_t(1) << int_bits) < texture_size) int_bits++;
+    assert(int_bits < 31);
+    span.shift = 31 - int_bits;
+
+    // Round the start and the step up: v then never falls below the exact coordinate and only
+    // creeps above it by count+1 units, too little to cross the next texel boundary
+    const uint64_t one = uint64_t(1) << span.shift;
+    span.v    = uint32_t((uint64_t(first) * texture_size * one + out_size - 1) / out_size);
+    span.step = uint32_t((uint64_t(texture_size) * one + out_size - 1) / out_size);
+}
+
+
+void setup_column_span_pow2(ColumnSpan& span, const unsigned size_shift, const size_t out_size, const size_t first)
+{
+    assert(size_shift < 31 && out_size > 0);
+
+    // As above: texture_size * one is 1 << (int_bits + shift), which is 2^31 for every size but 1
+    const unsigned int_bits = std::max(1u, size_shift);
+    span.shift = 31 - int_bits;
+
+    const unsigned total = size_shift + span.shift;
+    span.v    = first ? uint32_t(((uint64_t(first) << total) + out_size - 1) / out_size) : 0;
+    span.step = uint32_t(((uint64_t(1) << total) + out_size - 1) / out_size);
+}
+
+
+bool blit_isa_supported(const BlitIsa isa)
+{
+    switch (isa)
+    {
+        case BlitIsa::scalar: return true;
+#ifdef BLIT_X86
+        case BlitIsa::sse2:   return __builtin_cpu_supports("sse2");
+        case BlitIsa::avx2:   return __builtin_cpu_supports("avx2");
+#endif
+        default:              return false;
+    }
+}
+
+
+const char* blit_isa_name(const BlitIsa isa)
+{
+    switch (isa)
+    {
+        case BlitIsa::sse2: return "sse2";
+        case BlitIsa::avx2: return "avx2";
+        default:            return "scalar";
+    }
+}
+
+
+const BlitKernels& blit_kernels(const BlitIsa isa)
+{
+    assert(blit_isa_supported(isa));
+
+    static const BlitKernels scalar{BlitIsa::scalar, copy_scalar, alpha_test_scalar};
+#ifdef BLIT_X86
+    static const BlitKernels sse2{BlitIsa::sse2, column_sse2<false>, column_sse2<true>};
+    static const BlitKernels avx2{BlitIsa::avx2, column_avx2<false>, column_avx2<true>};
+
+    if (isa == BlitIsa::avx2) return avx2;
+    if (isa == BlitIsa::sse2) return sse2;
+#endif
+    return scalar;
+}
+
+
+BlitIsa best_blit_isa()
+{
+    if (blit_isa_supported(BlitIsa::avx2)) return BlitIsa::avx2;
+    if (blit_isa_supported(BlitIsa::sse2)) return BlitIsa::sse2;
+    return BlitIsa::scalar;
+}
+
+
+// Chosen at static initialisation, before any render thread can read it
+static const BlitKernels* g_selected = &blit_kernels(best_blit_isa());
+
+
+void select_blit_isa(const BlitIsa isa)
+{
+    g_selected = &blit_kernels(isa);
+}
+
+
+const BlitKernels& blit_kernels()
+{
+    return *g_selected;
+}
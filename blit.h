@@ -0,0 +1,69 @@
+#ifndef BLIT_H
+#define BLIT_H
+
+#include <cstdint>
+#include <cstdlib>
+
+
+// One vertically scaled texture column: output pixel k is the texel src[(v + k*step) >> shift],
+// written to dst[k*dst_stride]. The caller clips to the visible rows so kernels never check bounds.
+struct ColumnSpan
+{
+    const uint32_t* src;
+    size_t src_stride;   // Distance in pixels between consecutive texels of the column
+    uint32_t v;          // Fixed point texel coordinate of the first output pixel
+    uint32_t step;       // Fixed point texel step per output pixel
+    unsigned shift;      // Fractional bits of v and step
+    uint32_t* dst;
+    size_t dst_stride;   // Distance in pixels between consecutive output pixels
+    size_t count;
+};
+
+
+// Texels the alpha_test kernels draw
+inline bool is_opaque(const uint32_t colour) { return (colour >> 24) > 128; }
+
+
+typedef void (*ColumnKernel)(const ColumnSpan& span);
+
+
+enum class BlitIsa
+{
+    scalar,
+    sse2,
+    avx2
+};
+
+
+struct BlitKernels
+{
+    BlitIsa isa;
+    ColumnKernel copy;        // Opaque copy
+    ColumnKernel alpha_test;  // Copy only texels with alpha > 128
+};
+
+
+// Fill the fixed point fields of span for scaling texture_size texels to out_size pixels, starting
+// at output pixel first. The result matches (y*texture_size)/out_size exactly for every visible y
+// as long as (visible rows + 1) * out_size < 2^shift; beyond that texels are off by at most one.
+void setup_column_span(ColumnSpan& span, const size_t texture_size, const size_t out_size, const size_t first);
+
+// setup_column_span for a texture of 1 << size_shift texels: the same span, with the shift known
+// without searching for it and no divide for a span starting at the top of the column
+void setup_column_span_pow2(ColumnSpan& span, const unsigned size_shift, const size_t out_size, const size_t first);
+
+bool blit_isa_supported(const BlitIsa isa);
+const char* blit_isa_name(const BlitIsa isa);
+
+BlitIsa best_blit_isa();
+
+// Kernels for one instruction set (must be supported)
+const BlitKernels& blit_kernels(const BlitIsa isa);
+
+// Kernels used by the renderer: the best this CPU supports unless select_blit_isa() picked others.
+// Select before rendering starts, not while frames are being drawn.
+void select_blit_isa(const BlitIsa isa);
+const BlitKernels& blit_kernels();
+
+
+#endif
@@ -0,0 +1,178 @@
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <filesystem>
+#include <cstring>
+#include <cassert>
+
+#include "capture.h"
+#include "utils.h"
+
+
+FrameCapture::FrameCapture(const std::string& path, const size_t width, const size_t height,
+                           const CaptureSettings& settings)
+    : m_path(path), m_width(width), m_height(height), m_settings(settings), m_valid(true), m_stream(),
+      m_frames(std::max<size_t>(1, settings.queue_depth)), m_free(), m_queued(), m_out(), m_thread(), m_mtx(),
+      m_queued_cv(), m_free_cv(), m_pushed(0), m_written(0), m_dropped(0), m_failed(0), m_stop(false)
+{
+    if (settings.format == CaptureFormat::y4m)
+    {
+        m_stream.open(path, std::ios::binary);
+        m_stream << "YUV4MPEG2 W" << width << " H" << height << " F" << settings.fps << ":1 Ip A1:1 C444\n";
+        m_valid = bool(m_stream);
+    }
+    else
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(path, ec);
+        m_valid = std::filesystem::is_directory(path, ec);
+    }
+
+    if (!m_valid)
+    {
+        std::cerr << "Error: cannot capture frames to " << path << std::endl;
+        return;
+    }
+
+    for (Frame& frame : m_frames)
+    {
+        frame.pixels.resize(width * height);
+        m_free.push_back(&frame);
+    }
+
+    m_thread = std::thread(&FrameCapture::write_loop, this);
+}
+
+
+FrameCapture::~FrameCapture()
+{
+    if (!m_thread.joinable()) return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_stop = true;
+    }
+    m_queued_cv.notify_one();
+    m_thread.join();
+}
+
+
+bool FrameCapture::valid() const { return m_valid; }
+uint64_t FrameCapture::frames_written() const { return m_written.load(); }
+uint64_t FrameCapture::frames_dropped() const { return m_dropped.load(); }
+uint64_t FrameCapture::frames_failed() const { return m_failed.load(); }
+
+
+bool FrameCapture::push(const FrameBuffer& frame_buf)
+{
+    assert(frame_buf.width() == m_width && frame_buf.height() == m_height);
+    if (!m_valid) return false;
+
+    Frame* frame = nullptr;
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        const uint64_t index = m_pushed++;
+        if (m_settings.lossless)
+            m_free_cv.wait(lock, [this] { return !m_free.empty(); });
+
+        if (m_free.empty())
+        {
+            m_dropped++;
+            return false;
+        }
+
+        frame = m_free.back();
+        m_free.pop_back();
+        frame->index = index;
+    }
+
+    // The copy is the only work done on the caller's thread
+    for (size_t j = 0; j < m_height; j++)
+        std::memcpy(frame->pixels.data() + j * m_width, frame_buf.pixel_ptr(0, j), m_width * sizeof(uint32_t));
+
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_queued.push_back(frame);
+    }
+    m_queued_cv.notify_one();
+    return true;
+}
+
+
+void FrameCapture::write_loop()
+{
+    std::unique_lock<std::mutex> lock(m_mtx);
+
+    while (true)
+    {
+        m_queued_cv.wait(lock, [this] { return m_stop || !m_queued.empty(); });
+        if (m_queued.empty()) return;  // Stopping with nothing left to write
+
+        Frame* frame = m_queued.front();
+        m_queued.pop_front();
+        lock.unlock();
+        const bool ok = write(*frame);
+        lock.lock();
+
+        if (ok) m_written++;
+        else    m_failed++;
+        m_free.push_back(frame);
+        m_free_cv.notify_one();
+    }
+}
+
+
+// Limited range BT.601, as players assume for y4m without a colour range tag
+static void rgba_to_yuv444(const uint32_t* src, const size_t count, uint8_t* y, uint8_t* u, uint8_t* v)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        const int r = src[i] & 255;
+        const int g = (src[i] >> 8) & 255;
+        const int b = (src[i] >> 16) & 255;
+        y[i] = uint8_t((( 66*r + 129*g +  25*b + 128) >> 8) + 16);
+        u[i] = uint8_t(((-38*r -  74*g + 112*b + 128) >> 8) + 128);
+        v[i] = uint8_t(((112*r -  94*g -  18*b + 128) >> 8) + 128);
+    }
+}
+
+
+bool FrameCapture::write(const Frame& frame)
+{
+    const size_t count = m_width * m_height;
+
+    if (m_settings.format == CaptureFormat::y4m)
+    {
+        static const char tag[] = "FRAME\n";
+        m_out.resize(sizeof(tag) - 1 + count * 3);
+        std::memcpy(m_out.data(), tag, sizeof(tag) - 1);
+        uint8_t* planes = m_out.data() + sizeof(tag) - 1;
+        rgba_to_yuv444(frame.pixels.data(), count, planes, planes + count, planes + 2*count);
+
+        const bool was_good = bool(m_stream);  // Report a failing stream once, not every frame
+        m_stream.write(reinterpret_cast<const char*>(m_out.data()), m_out.size());
+        if (!m_stream)
+        {
+            if (was_good) std::cerr << "Error: cannot write frame " << frame.index << " to " << m_path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    const std::string header = "P6\n" + std::to_string(m_width) + " " + std::to_string(m_height) + "\n255\n";
+    m_out.resize(header.size() + count * 3);
+    std::memcpy(m_out.data(), header.data(), header.size());
+    rgba_to_rgb(frame.pixels.data(), count, m_out.data() + header.size());
+
+    std::ostringstream name;
+    name << m_path << "/frame_" << std::setw(6) << std::setfill('0') << frame.index << ".ppm";
+    std::ofstream ofs(name.str(), std::ios::binary);
+    ofs.write(reinterpret_cast<const char*>(m_out.data()), m_out.size());
+    if (!ofs)
+    {
+        std::cerr << "Error: cannot write frame " << name.str() << std::endl;
+        return false;
+    }
+    return true;
+}
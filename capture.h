@@ -0,0 +1,96 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <deque>
+#include <fstream>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "framebuffer.h"
+
+
+enum class CaptureFormat
+{
+    ppm,  // One numbered PPM per frame in a directory: frame_000000.ppm, ...
+    y4m   // One YUV4MPEG2 stream (4:4:4), playable by ffmpeg and mpv
+};
+
+
+struct CaptureSettings
+{
+    CaptureFormat format = CaptureFormat::ppm;
+    size_t queue_depth = 8;  // Frames waiting for the writer; push() drops frames beyond that
+    unsigned fps = 60;       // Frame rate recorded in the y4m header
+    bool lossless = false;   // push() waits for a free slot instead of dropping the frame
+};
+
+
+// Streams frames to disk on a background writer thread. push() only copies the frame into one of
+// queue_depth preallocated slots, so the render loop never waits on the disk: when every slot is
+// still queued the frame is dropped and counted instead. The writer converts each frame into a
+// reused buffer and writes it with a single call.
+//
+// PPM frames are named after their push() index, so dropped frames leave gaps in the numbering.
+class FrameCapture
+{
+public:
+    // Capture width x height frames to path: a directory (created if needed) for PPM, a file for y4m.
+    // On failure valid() is false and the error is printed.
+    FrameCapture(const std::string& path, const size_t width, const size_t height,
+                 const CaptureSettings& settings = CaptureSettings());
+    ~FrameCapture();  // Writes out every queued frame
+
+    FrameCapture(const FrameCapture&) = delete;
+    FrameCapture& operator=(const FrameCapture&) = delete;
+
+    bool valid() const;
+
+    // Queue a copy of frame_buf, which must be width x height; safe from any thread.
+    // False if the frame was dropped.
+    bool push(const FrameBuffer& frame_buf);
+
+    uint64_t frames_written() const;
+    uint64_t frames_dropped() const;  // Pushed while the queue was full
+    uint64_t frames_failed() const;   // Queued, but the write failed
+
+private:
+    struct Frame
+    {
+        std::vector<uint32_t> pixels;
+        uint64_t index = 0;
+    };
+
+    std::string m_path;
+    size_t m_width;
+    size_t m_height;
+    CaptureSettings m_settings;
+    bool m_valid;
+    std::ofstream m_stream;         // y4m output
+
+    std::vector<Frame> m_frames;
+    std::vector<Frame*> m_free;     // Slots push() may fill
+    std::deque<Frame*> m_queued;    // Filled slots, oldest first
+    std::vector<uint8_t> m_out;     // Writer thread's converted frame
+
+    std::thread m_thread;
+    std::mutex m_mtx;
+    std::condition_variable m_queued_cv;
+    std::condition_variable m_free_cv;
+    uint64_t m_pushed;
+    std::atomic<uint64_t> m_written;
+    std::atomic<uint64_t> m_dropped;
+    std::atomic<uint64_t> m_failed;
+    bool m_stop;
+
+    void write_loop();
+    bool write(const Frame& frame);
+};
+
+
+#endif
@@ -0,0 +1,173 @@
+#include <algorithm>
+
+#include "flow_field.h"
+
+
+// Directions clockwise from east, y growing downwards; direction d + 4 is the opposite of d
+static const int step_di[8] = {1, 1, 0, -1, -1, -1,  0,  1};
+static const int step_dj[8] = {0, 1, 1,  1,  0, -1, -1, -1};
+static const float diagonal = 0.70710678f;
+
+const uint8_t FlowField::no_step;
+const uint16_t FlowField::unreachable;
+const float FlowField::step_x[8] = {1, diagonal, 0, -diagonal, -1, -diagonal,  0,  diagonal};
+const float FlowField::step_y[8] = {0, diagonal, 1,  diagonal,  0, -diagonal, -1, -diagonal};
+
+
+FlowField::FlowField(const bool background)
+    : m_background(background), m_front(), m_back(), m_queue(), m_open(), m_map(nullptr), m_request_i(0), m_request_j(0),
+      m_requested(false), m_building(false), m_finished(false), m_stop(false), m_thread(), m_mtx(),
+      m_request_cv(), m_finished_cv()
+{
+    if (m_background) m_thread = std::thread(&FlowField::build_loop, this);
+}
+
+
+FlowField::~FlowField()
+{
+    if (!m_thread.joinable()) return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_stop = true;
+    }
+    m_request_cv.notify_one();
+    m_thread.join();
+}
+
+
+bool FlowField::ready() const { return m_front.width != 0; }
+size_t FlowField::target_i() const { return m_front.target_i; }
+size_t FlowField::target_j() const { return m_front.target_j; }
+size_t FlowField::reachable() const { return m_front.reachable; }
+
+
+void FlowField::update(const Map& map, const size_t i, const size_t j)
+{
+    if (!m_background)
+    {
+        if (m_requested && m_map == &map && m_request_i == i && m_request_j == j) return;
+        m_map = &map;
+        m_request_i = i;
+        m_request_j = j;
+        m_requested = true;
+        build(map, i, j, m_front);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (m_finished)
+        {
+            std::swap(m_front, m_back);
+            m_finished = false;
+        }
+
+        // A build for an older target finishes first; the one after it catches up
+        if (m_building || (m_requested && m_map == &map && m_request_i == i && m_request_j == j)) return;
+
+        m_map = &map;
+        m_request_i = i;
+        m_request_j = j;
+        m_requested = true;
+        m_building = true;
+    }
+    m_request_cv.notify_one();
+}
+
+
+void FlowField::wait()
+{
+    std::unique_lock<std::mutex> lock(m_mtx);
+    m_finished_cv.wait(lock, [this] { return !m_building; });
+}
+
+
+void FlowField::build_loop()
+{
+    std::unique_lock<std::mutex> lock(m_mtx);
+
+    while (true)
+    {
+        m_request_cv.wait(lock, [this] { return m_stop || m_building; });
+        if (m_stop) return;
+
+        // The tick thread leaves m_back alone until the build is marked finished
+        const Map& map = *m_map;
+        const size_t i = m_request_i;
+        const size_t j = m_request_j;
+        lock.unlock();
+        build(map, i, j, m_back);
+        lock.lock();
+
+        m_building = false;
+        m_finished = true;
+        m_finished_cv.notify_all();
+    }
+}
+
+
+void FlowField::build(const Map& map, const size_t target_i, const size_t target_j, Grid& grid)
+{
+    const size_t w = map.width();
+    const size_t h = map.height();
+    const size_t pw = w + 2;
+    const size_t count = pw * (h + 2);
+
+    grid.width = w;
+    grid.height = h;
+    grid.target_i = target_i;
+    grid.target_j = target_j;
+    grid.reachable = 0;
+    grid.steps.assign(count, no_step);
+    grid.dist.assign(count, unreachable);
+    if (target_i >= w || target_j >= h || !map.is_empty(target_i, target_j)) return;
+
+    m_open.assign(count, 0);
+    for (size_t j = 0; j < h; j++)
+        for (size_t i = 0; i < w; i++)
+            m_open[(i + 1) + (j + 1)*pw] = map.is_empty(i, j);
+
+    long offset[8];
+    for (size_t d = 0; d < 8; d++)
+        offset[d] = step_di[d] + step_dj[d] * long(pw);
+
+    // Breadth-first from the target: every cell is queued once, when first reached, and steps
+    // back towards the cell it was reached from
+    m_queue.resize(w * h);
+    size_t head = 0;
+    size_t tail = 0;
+    const uint32_t target = uint32_t((target_i + 1) + (target_j + 1)*pw);
+    m_queue[tail++] = target;
+    grid.dist[target] = 0;
+
+    uint32_t* queue = m_queue.data();
+    const uint8_t* open = m_open.data();
+    uint16_t* dist = grid.dist.data();
+    uint8_t* steps = grid.steps.data();
+
+    while (head < tail)
+    {
+        const uint32_t cell = queue[head++];
+        const uint16_t next_dist = uint16_t(std::min<uint32_t>(dist[cell] + 1u, unreachable - 1u));
+
+        // A diagonal step needs both cells beside it open, so it never cuts a wall corner
+        bool can_step[8];
+        for (size_t d = 0; d < 8; d += 2)
+            can_step[d] = open[cell + offset[d]];
+        for (size_t d = 1; d < 8; d += 2)
+            can_step[d] = can_step[d - 1] && can_step[(d + 1) % 8] && open[cell + offset[d]];
+
+        for (size_t d = 0; d < 8; d++)
+        {
+            const uint32_t next = uint32_t(cell + offset[d]);
+            if (!can_step[d] || dist[next] != unreachable) continue;
+
+            dist[next] = next_dist;
+            steps[next] = uint8_t((d + 4) % 8);
+            queue[tail++] = next;
+        }
+    }
+
+    grid.reachable = tail;
+}
@@ -0,0 +1,101 @@
+#ifndef FLOW_FIELD_H
+#define FLOW_FIELD_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "map.h"
+
+
+// Shortest paths from every empty cell of a map to one target cell (the player's), shared by
+// all the monsters: each cell holds the direction of its next step, so following a path costs
+// one lookup per cell whatever the number of monsters. The field is a breadth-first search over
+// the 8-neighbourhood that never cuts a wall corner, rebuilt only when the target changes cell.
+//
+// Rebuilds run on a background thread into a second buffer. update() never waits for them: it
+// publishes a finished build and starts the next one, and until then the previous field stays
+// in use. Readers use the field between two update() calls, from any number of threads.
+class FlowField
+{
+public:
+    static const uint8_t no_step = 8;             // At the target, unreachable or outside the map
+    static const uint16_t unreachable = 65535;
+    static const float step_x[8];                 // Unit vector of each step direction
+    static const float step_y[8];
+
+    // With background false, update() rebuilds in place before returning, for reproducible runs
+    explicit FlowField(const bool background = true);
+    ~FlowField();
+
+    FlowField(const FlowField&) = delete;
+    FlowField& operator=(const FlowField&) = delete;
+
+    // Point the field at cell (i,j) of map. map must stay alive and unchanged while a build runs.
+    void update(const Map& map, const size_t i, const size_t j);
+
+    // Block until the build in progress, if any, is finished; the next update() publishes it
+    void wait();
+
+    bool ready() const;          // A field has been published
+    size_t target_i() const;
+    size_t target_j() const;
+    size_t reachable() const;    // Cells with a path to the target, the target included
+
+    // Direction index of the next step from cell (i,j), or no_step
+    uint8_t step(const size_t i, const size_t j) const
+    {
+        if (i >= m_front.width || j >= m_front.height) return no_step;
+        return m_front.steps[(i + 1) + (j + 1)*(m_front.width + 2)];
+    }
+
+    // Steps from cell (i,j) to the target, capped at unreachable - 1
+    uint16_t distance(const size_t i, const size_t j) const
+    {
+        if (i >= m_front.width || j >= m_front.height) return unreachable;
+        return m_front.dist[(i + 1) + (j + 1)*(m_front.width + 2)];
+    }
+
+private:
+    // Cells are stored with a one cell border around the map, so that the search needs no bounds
+    // checks: cell (i,j) is at (i+1) + (j+1)*(width+2)
+    struct Grid
+    {
+        size_t width = 0;
+        size_t height = 0;
+        size_t target_i = 0;
+        size_t target_j = 0;
+        size_t reachable = 0;
+        std::vector<uint8_t> steps;
+        std::vector<uint16_t> dist;
+    };
+
+    bool m_background;
+    Grid m_front;                  // Published field, read between update() calls
+    Grid m_back;                   // Being built, or finished and waiting to be published
+    std::vector<uint32_t> m_queue; // Search frontier, reused between builds
+    std::vector<uint8_t> m_open;   // Empty cells of the map being searched, with the border closed
+
+    // Request for the builder, guarded by m_mtx
+    const Map* m_map;
+    size_t m_request_i;
+    size_t m_request_j;
+    bool m_requested;              // Target of the last request, built or not
+    bool m_building;
+    bool m_finished;               // m_back holds a build not yet published
+    bool m_stop;
+
+    std::thread m_thread;
+    std::mutex m_mtx;
+    std::condition_variable m_request_cv;
+    std::condition_variable m_finished_cv;
+
+    void build_loop();
+    void build(const Map& map, const size_t target_i, const size_t target_j, Grid& grid);
+};
+
+
+#endif
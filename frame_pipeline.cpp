@@ -0,0 +1,168 @@
+#include <iostream>
+#include <algorithm>
+#include <cassert>
+
+#include "frame_pipeline.h"
+#include "profiler.h"
+
+
+FramePipeline::FramePipeline(SDL_Renderer* renderer, const size_t width, const size_t height, const size_t depth,
+                             const RenderJob& job)
+    : m_renderer(renderer), m_width(width), m_height(height), m_job(job), m_slots(), m_stats(), m_valid(true),
+      m_thread(), m_mtx(), m_submitted_cv(), m_rendered_cv(), m_submitted(0), m_rendered(0), m_presented(0),
+      m_stop(false)
+{
+    assert(depth > 0);
+
+    m_slots.reserve(depth);
+    for (size_t i = 0; i < depth; i++)
+    {
+        m_slots.emplace_back(width, height);
+        m_slots.back().texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING,
+                                                   int(width), int(height));
+        if (!m_slots.back().texture)
+        {
+            std::cerr << "Failed to create framebuffer texture : " << SDL_GetError() << std::endl;
+            m_valid = false;
+        }
+    }
+
+    m_thread = std::thread(&FramePipeline::render_loop, this);
+}
+
+
+FramePipeline::~FramePipeline()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_rendered_cv.wait(lock, [this] { return m_rendered == m_submitted; });
+        m_stop = true;
+    }
+    m_submitted_cv.notify_one();
+    m_thread.join();
+
+    for (Slot& slot : m_slots)
+    {
+        if (slot.locked) SDL_UnlockTexture(slot.texture);
+        if (slot.texture) SDL_DestroyTexture(slot.texture);
+    }
+}
+
+
+bool FramePipeline::valid() const { return m_valid; }
+size_t FramePipeline::depth() const { return m_slots.size(); }
+const PipelineStats& FramePipeline::stats() const { return m_stats; }
+size_t FramePipeline::next_slot() const { return m_submitted % m_slots.size(); }
+
+
+void FramePipeline::render_loop()
+{
+    std::unique_lock<std::mutex> lock(m_mtx);
+
+    while (true)
+    {
+        m_submitted_cv.wait(lock, [this] { return m_stop || m_rendered < m_submitted; });
+        if (m_rendered == m_submitted) return;  // Stopping with nothing left to draw
+
+        const size_t slot = m_rendered % m_slots.size();
+        lock.unlock();
+        m_job(m_slots[slot].frame_buf, slot);
+        lock.lock();
+
+        m_rendered++;
+        m_rendered_cv.notify_all();
+    }
+}
+
+
+// Point the slot's FrameBuffer at its locked texture, or at owned pixels when it cannot be locked
+void FramePipeline::prepare(Slot& slot)
+{
+    void* pixels = nullptr;
+    int pitch = 0;
+
+    assert(!slot.locked);
+    if (slot.texture && SDL_LockTexture(slot.texture, NULL, &pixels, &pitch) == 0)
+    {
+        slot.locked = true;
+        slot.frame_buf = FrameBuffer(m_width, m_height, static_cast<uint32_t*>(pixels), size_t(pitch) / 4);
+    }
+    else if (slot.in_texture)
+    {
+        slot.frame_buf = FrameBuffer(m_width, m_height, 0);
+    }
+    slot.in_texture = slot.locked;
+}
+
+
+void FramePipeline::submit(const Clock::time_point input_time)
+{
+    Slot& slot = m_slots[next_slot()];
+    prepare(slot);
+    slot.submitted = Clock::now();
+    slot.input_time = input_time;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_submitted++;
+    }
+    m_submitted_cv.notify_one();
+
+    while (m_submitted - m_presented >= m_slots.size())
+        present_oldest();
+}
+
+
+void FramePipeline::flush()
+{
+    while (m_presented < m_submitted)
+        present_oldest();
+}
+
+
+void FramePipeline::present_oldest()
+{
+    {
+        PROFILE_SCOPE("present_wait");
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_rendered_cv.wait(lock, [this] { return m_rendered > m_presented; });
+    }
+
+    Slot& slot = m_slots[m_presented % m_slots.size()];
+
+    if (slot.texture)
+    {
+        {
+            PROFILE_SCOPE("upload");
+            if (slot.locked)
+            {
+                SDL_UnlockTexture(slot.texture);  // Uploads what the render thread wrote in place
+                slot.locked = false;
+            }
+            else
+            {
+                SDL_UpdateTexture(slot.texture, NULL, slot.frame_buf.pixel_ptr(0, 0), int(slot.frame_buf.pitch() * 4));
+            }
+        }
+
+        PROFILE_SCOPE("present");
+        SDL_RenderClear(m_renderer);
+        SDL_RenderCopy(m_renderer, slot.texture, NULL, NULL);
+        SDL_RenderPresent(m_renderer);
+    }
+
+    const Clock::time_point presented = Clock::now();
+    const double latency = std::chrono::duration<double, std::milli>(presented - slot.submitted).count();
+    m_presented++;
+
+    if (slot.input_time != Clock::time_point())
+    {
+        const double input_latency = std::chrono::duration<double, std::milli>(presented - slot.input_time).count();
+        m_stats.input_frames++;
+        m_stats.input_latency_ms += (input_latency - m_stats.input_latency_ms) / double(m_stats.input_frames);
+    }
+    m_stats.frames = m_presented;
+    m_stats.latency_ms = latency;
+    m_stats.mean_latency_ms += (latency - m_stats.mean_latency_ms) / double(m_stats.frames);
+    m_stats.max_latency_ms = std::max(m_stats.max_latency_ms, latency);
+}
@@ -0,0 +1,101 @@
+#ifndef FRAME_PIPELINE_H
+#define FRAME_PIPELINE_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include "SDL.h"
+
+#include "framebuffer.h"
+
+
+struct PipelineStats
+{
+    uint64_t frames = 0;          // Frames presented
+    double latency_ms = 0;        // Submit to present of the last frame
+    double mean_latency_ms = 0;
+    double max_latency_ms = 0;
+    double input_latency_ms = 0;  // Input event to present, mean over the frames carrying input
+    uint64_t input_frames = 0;
+};
+
+
+// Renders frames on a dedicated thread while the thread owning the SDL renderer uploads and
+// presents the earlier ones. Up to depth frames are in flight: depth 1 renders then presents,
+// depth 2 presents frame N while frame N+1 renders, depth 3 queues one frame more.
+//
+// Each slot has its own streaming texture, locked while its frame renders so the pixels are
+// written straight into it. If locking fails the slot renders into its own FrameBuffer instead,
+// uploaded with SDL_UpdateTexture.
+class FramePipeline
+{
+public:
+    // Renders one frame into frame_buf on the render thread. slot tells which snapshot of the
+    // game state to draw: the caller fills snapshot next_slot() before each submit().
+    typedef std::function<void(FrameBuffer& frame_buf, size_t slot)> RenderJob;
+
+    FramePipeline(SDL_Renderer* renderer, const size_t width, const size_t height, const size_t depth,
+                  const RenderJob& job);
+    ~FramePipeline();
+
+    FramePipeline(const FramePipeline&) = delete;
+    FramePipeline& operator=(const FramePipeline&) = delete;
+
+    bool valid() const;   // False if a texture could not be created (error printed)
+    size_t depth() const;
+    const PipelineStats& stats() const;
+
+    // Slot the next submit() renders; it is not in use by the render thread
+    size_t next_slot() const;
+
+    // Queue the next frame, then present the oldest ones until fewer than depth are in flight.
+    // input_time is when the oldest input this frame reflects happened, if any.
+    void submit(const std::chrono::steady_clock::time_point input_time = std::chrono::steady_clock::time_point());
+
+    // Present every frame in flight
+    void flush();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Slot
+    {
+        SDL_Texture* texture = nullptr;
+        bool locked = false;
+        bool in_texture = false;      // frame_buf points into the texture (locked at some point)
+        FrameBuffer frame_buf;        // Over the locked texture, or owned pixels when locking failed
+        Clock::time_point submitted;
+        Clock::time_point input_time;
+
+        Slot(const size_t width, const size_t height) : frame_buf(width, height, 0) {}
+    };
+
+    SDL_Renderer* m_renderer;
+    size_t m_width;
+    size_t m_height;
+    RenderJob m_job;
+    std::vector<Slot> m_slots;
+    PipelineStats m_stats;
+    bool m_valid;
+
+    std::thread m_thread;
+    std::mutex m_mtx;
+    std::condition_variable m_submitted_cv;
+    std::condition_variable m_rendered_cv;
+    uint64_t m_submitted;   // Frame counters: frame k uses slot k % depth
+    uint64_t m_rendered;
+    uint64_t m_presented;
+    bool m_stop;
+
+    void render_loop();
+    void prepare(Slot& slot);
+    void present_oldest();
+};
+
+
+#endif
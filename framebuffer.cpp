@@ -1,28 +1,55 @@
 #include <iostream>
 #include <vector>
 #include <cassert>
+#include <cstdlib>
+#include <algorithm>
 
 #include "utils.h"
 #include "framebuffer.h"
 
 
 FrameBuffer::FrameBuffer(size_t width, size_t height, uint32_t colour)
-    : m_width(width), m_height(height), m_img(width*height, colour)
+    : m_width(width), m_height(height), m_pitch(width), m_img(width*height, colour), m_external(nullptr)
 {
 }
 
 
+FrameBuffer::FrameBuffer(size_t width, size_t height, uint32_t* pixels, size_t pitch)
+    : m_width(width), m_height(height), m_pitch(pitch), m_img(), m_external(pixels)
+{
+    assert(pixels && pitch >= width);
+}
+
+
 size_t FrameBuffer::width()  const { return m_width; }
 size_t FrameBuffer::height() const { return m_height; }
-const std::vector<uint32_t>& FrameBuffer::img() const { return m_img; }
+size_t FrameBuffer::pitch()  const { return m_pitch; }
+
+const std::vector<uint32_t>& FrameBuffer::img() const
+{
+    assert(!m_external);
+    return m_img;
+}
+
+
+uint32_t* FrameBuffer::pixel_ptr(const size_t x, const size_t y)
+{
+    assert(x < m_width && y < m_height);
+    return pixels() + x + y*m_pitch;
+}
+
+
+const uint32_t* FrameBuffer::pixel_ptr(const size_t x, const size_t y) const
+{
+    assert(x < m_width && y < m_height);
+    return (m_external ? m_external : m_img.data()) + x + y*m_pitch;
+}
 
 
 void FrameBuffer::set_pixel(const size_t x, const size_t y, const uint32_t colour)
 {
-    assert(m_img.size() == m_width * m_height
-                    && x < m_width
-                    && y < m_height);
-    m_img[x + y*m_width] = colour;
+    assert(x < m_width && y < m_height);
+    pixels()[x + y*m_pitch] = colour;
 }
 
 
@@ -30,23 +57,47 @@ void FrameBuffer::draw_rectangle(const size_t rect_x, const size_t rect_y,
                                  const size_t rect_w, const size_t rect_h, 
                                  const uint32_t colour)
 {
-    assert(m_img.size() == m_width * m_height);
+    // Clip once, then fill row by row
+    if (rect_x >= m_width || rect_y >= m_height) return;
+    const size_t x_end = rect_x + std::min(rect_w, m_width - rect_x);
+    const size_t y_end = rect_y + std::min(rect_h, m_height - rect_y);
+
+    for (size_t j = rect_y; j < y_end; j++)
+        std::fill(pixels() + rect_x + j*m_pitch, pixels() + x_end + j*m_pitch, colour);
+}
+
 
-    for (size_t i = 0; i < rect_w; i++)
+void FrameBuffer::draw_line(const long x0, const long y0, const long x1, const long y1, const uint32_t colour)
+{
+    // Bresenham, skipping the pixels outside the buffer
+    const long dx = std::abs(x1 - x0);
+    const long dy = -std::abs(y1 - y0);
+    const long step_x = (x0 < x1) ? 1 : -1;
+    const long step_y = (y0 < y1) ? 1 : -1;
+    long err = dx + dy;
+    long x = x0;
+    long y = y0;
+
+    while (true)
     {
-        for (size_t j = 0; j < rect_h; j++)
-        {
-            size_t cx = rect_x + i;
-            size_t cy = rect_y + j;
-            
-            if (cx < m_width && cy < m_height)
-                set_pixel(cx, cy, colour);
-        }
+        if (x >= 0 && y >= 0 && x < long(m_width) && y < long(m_height))
+            pixels()[x + y*m_pitch] = colour;
+        if (x == x1 && y == y1) break;
+
+        const long err2 = 2*err;
+        if (err2 >= dy) { err += dy; x += step_x; }
+        if (err2 <= dx) { err += dx; y += step_y; }
     }
 }
 
 
 void FrameBuffer::clear(const uint32_t colour)
 {
-    m_img = std::vector<uint32_t>(m_width * m_height, colour);
+    if (m_pitch == m_width)
+    {
+        std::fill(pixels(), pixels() + m_width*m_height, colour);  // In place, no reallocation
+        return;
+    }
+    for (size_t j = 0; j < m_height; j++)
+        std::fill(pixels() + j*m_pitch, pixels() + j*m_pitch + m_width, colour);
 }
\ No newline at end of file
@@ -9,22 +9,39 @@ class FrameBuffer
 {
     size_t m_width;
     size_t m_height;
+    size_t m_pitch;           // Pixels from one row to the next
     std::vector<uint32_t> m_img;
+    uint32_t* m_external;     // Pixels owned by someone else, nullptr when m_img holds them
+
+    uint32_t* pixels() { return m_external ? m_external : m_img.data(); }
 
 public:
     // Constructor initialises whole m_img to one colour
     FrameBuffer(size_t width, size_t height, uint32_t colour);
 
+    // Draw into memory owned elsewhere, such as a locked streaming texture, with rows pitch
+    // pixels apart. The memory must outlive the FrameBuffer; img() is not available.
+    FrameBuffer(size_t width, size_t height, uint32_t* pixels, size_t pitch);
+
     size_t width() const;
     size_t height() const;
+    size_t pitch() const;
     const std::vector<uint32_t>& img() const;
 
+    // Address of pixel (x,y); rows are pitch() pixels apart
+    uint32_t* pixel_ptr(const size_t x, const size_t y);
+    const uint32_t* pixel_ptr(const size_t x, const size_t y) const;
+
     void set_pixel(const size_t x, const size_t y, 
                    const uint32_t colour);
     
     void draw_rectangle(const size_t x, const size_t y, 
                         const size_t w, const size_t h, 
                         const uint32_t colour);
+
+    // Line from (x0,y0) to (x1,y1), both ends included, clipped to the buffer
+    void draw_line(const long x0, const long y0, const long x1, const long y1,
+                   const uint32_t colour);
     
     void clear(const uint32_t colour);
 };
@@ -0,0 +1,111 @@
+#include <thread>
+#include <algorithm>
+
+#include "game_loop.h"
+
+
+GameLoop::GameLoop(const GameLoopSettings& settings)
+    : m_settings(settings), m_stats(), m_window_start(), m_window_ticks(0), m_window_frames(0),
+      m_window_sleep(0), m_window_spin(0)
+{
+}
+
+
+GameLoopSettings& GameLoop::settings() { return m_settings; }
+const LoopStats& GameLoop::stats() const { return m_stats; }
+
+
+// Hybrid wait: sleep in one go until spin_ms before the deadline, then spin the rest out, so a
+// late wakeup from the OS scheduler does not make the frame late
+void GameLoop::wait_until(const Clock::time_point deadline)
+{
+    const Clock::duration spin = std::chrono::duration_cast<Clock::duration>(
+                                 std::chrono::duration<double, std::milli>(m_settings.spin_ms));
+
+    Clock::time_point now = Clock::now();
+    if (deadline - now > spin)
+    {
+        std::this_thread::sleep_for(deadline - now - spin);
+        Clock::time_point woken = Clock::now();
+        m_window_sleep += woken - now;
+        now = woken;
+    }
+
+    const Clock::time_point spin_start = now;
+    while (now < deadline)
+    {
+        std::this_thread::yield();
+        now = Clock::now();
+    }
+    m_window_spin += now - spin_start;
+}
+
+
+void GameLoop::update_stats(const Clock::time_point now)
+{
+    const double seconds = std::chrono::duration<double>(now - m_window_start).count();
+    if (seconds < 1) return;
+
+    m_stats.tick_rate  = m_window_ticks / seconds;
+    m_stats.frame_rate = m_window_frames / seconds;
+    m_stats.sleep_ms   = std::chrono::duration<double, std::milli>(m_window_sleep).count() / seconds;
+    m_stats.spin_ms    = std::chrono::duration<double, std::milli>(m_window_spin).count() / seconds;
+    m_stats.windows++;
+
+    m_window_start  = now;
+    m_window_ticks  = 0;
+    m_window_frames = 0;
+    m_window_sleep  = Clock::duration(0);
+    m_window_spin   = Clock::duration(0);
+}
+
+
+void GameLoop::run(const std::function<bool()>& input, const std::function<void()>& tick,
+                   const std::function<void(double alpha)>& render)
+{
+    const Clock::duration tick_time = std::chrono::duration_cast<Clock::duration>(
+                                      std::chrono::duration<double>(1. / m_settings.tick_hz));
+
+    m_stats = LoopStats();
+    Clock::time_point last = Clock::now();
+    Clock::time_point next_frame = last;
+    Clock::duration lag(0);  // Simulation time due but not yet ticked
+    m_window_start = last;
+
+    while (true)
+    {
+        const Clock::time_point now = Clock::now();
+        lag += now - last;
+        last = now;
+
+        if (!input()) break;
+
+        size_t ticks = 0;
+        while (lag >= tick_time && ticks < m_settings.max_ticks_per_frame)
+        {
+            tick();
+            lag -= tick_time;
+            ticks++;
+        }
+        // Too far behind to catch up (stalled window, debugger): let the simulation run slow
+        if (lag >= tick_time) lag = tick_time - Clock::duration(1);
+
+        render(std::chrono::duration<double>(lag) / std::chrono::duration<double>(tick_time));
+
+        m_stats.ticks  += ticks;
+        m_stats.frames += 1;
+        m_window_ticks += ticks;
+        m_window_frames++;
+
+        if (m_settings.frame_hz > 0)
+        {
+            // Deadlines advance by whole periods so the frame rate does not drift; after a slow
+            // frame the schedule restarts from now instead of bursting to catch up
+            next_frame += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1. / m_settings.frame_hz));
+            if (next_frame < Clock::now()) next_frame = Clock::now();
+            wait_until(next_frame);
+        }
+
+        update_stats(Clock::now());
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef GAME_LOOP_H
+#define GAME_LOOP_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <chrono>
+#include <functional>
+
+
+struct GameLoopSettings
+{
+    double tick_hz  = 50;    // Simulation ticks per second, independent of the render rate
+    double frame_hz = 60;    // Render rate cap, 0 = uncapped (render as fast as possible)
+    double spin_ms  = 1;     // Final stretch of every wait spent spinning, as sleeps overshoot
+    size_t max_ticks_per_frame = 5;  // Beyond this the simulation drops time instead of catching up
+};
+
+
+// Rates over the last completed one second window
+struct LoopStats
+{
+    double tick_rate  = 0;   // Simulation ticks per second
+    double frame_rate = 0;   // Rendered frames per second
+    double sleep_ms   = 0;   // Per second: time asleep, and time spinning before a frame deadline
+    double spin_ms    = 0;
+    uint64_t ticks    = 0;   // Totals since run() started
+    uint64_t frames   = 0;
+    uint64_t windows  = 0;   // Completed windows, bumped whenever the rates above change
+};
+
+
+// Fixed timestep game loop: the simulation advances in ticks of exactly 1/tick_hz seconds however
+// fast frames are drawn, and each frame is rendered with the fraction of a tick elapsed since the
+// last one, for interpolating between the previous and the current simulation state.
+class GameLoop
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit GameLoop(const GameLoopSettings& settings = GameLoopSettings());
+
+    GameLoopSettings& settings();
+    const LoopStats& stats() const;
+
+    // Every frame: input() (the loop ends when it returns false), then tick() as many times as
+    // simulation time is due, then render(alpha) with alpha in [0, 1) the fraction of the next tick
+    // already elapsed, then wait for the next frame deadline.
+    void run(const std::function<bool()>& input, const std::function<void()>& tick,
+             const std::function<void(double alpha)>& render);
+
+private:
+    GameLoopSettings m_settings;
+    LoopStats m_stats;
+
+    // Stats of the window in progress
+    Clock::time_point m_window_start;
+    uint64_t m_window_ticks;
+    uint64_t m_window_frames;
+    Clock::duration m_window_sleep;
+    Clock::duration m_window_spin;
+
+    void wait_until(const Clock::time_point deadline);
+    void update_stats(const Clock::time_point now);
+};
+
+
+#endif
@@ -0,0 +1,281 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <algorithm>
+
+#include "input.h"
+
+
+static const char* const action_names[] = {"forward", "back", "turn_left", "turn_right", "quit"};
+static_assert(sizeof(action_names) / sizeof(action_names[0]) == size_t(Action::count), "one name per action");
+
+
+// Recording file header
+struct RecordingHeader
+{
+    char magic[8];
+    uint32_t count;
+    uint32_t reserved;
+};
+static_assert(sizeof(RecordingHeader) == 16, "recording header must stay 16 bytes");
+
+static const char recording_magic[8] = {'F', 'P', 'S', 'I', 'N', 'P', 'T', '1'};
+
+
+InputBindings::InputBindings()
+    : m_keys()
+{
+    bind('w', Action::forward);
+    bind('s', Action::back);
+    bind('a', Action::turn_left);
+    bind('d', Action::turn_right);
+    bind(SDLK_UP, Action::forward);
+    bind(SDLK_DOWN, Action::back);
+    bind(SDLK_LEFT, Action::turn_left);
+    bind(SDLK_RIGHT, Action::turn_right);
+    bind(SDLK_ESCAPE, Action::quit);
+}
+
+
+void InputBindings::clear() { m_keys.clear(); }
+
+
+void InputBindings::bind(const SDL_Keycode key, const Action action)
+{
+    for (std::pair<SDL_Keycode, Action>& binding : m_keys)
+    {
+        if (binding.first == key)
+        {
+            binding.second = action;
+            return;
+        }
+    }
+    m_keys.push_back(std::make_pair(key, action));
+}
+
+
+bool InputBindings::load(const std::string& filename)
+{
+    std::ifstream ifs(filename);
+    if (!ifs)
+    {
+        std::cerr << "Error: cannot open key bindings " << filename << std::endl;
+        return false;
+    }
+
+    InputBindings loaded;
+    loaded.clear();
+
+    std::string line;
+    for (size_t line_no = 1; std::getline(ifs, line); line_no++)
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream ls(line);
+        std::string key_name, action_name;
+        if (!(ls >> key_name)) continue;
+
+        ls >> action_name;
+        const char* const* name = std::find(std::begin(action_names), std::end(action_names), action_name);
+        SDL_Keycode key = SDL_GetKeyFromName(key_name.c_str());
+
+        if (key == SDLK_UNKNOWN || name == std::end(action_names))
+        {
+            std::cerr << "Error: key bindings " << filename << " line " << line_no << ": expected "
+                      << "<key name> <action>" << std::endl;
+            return false;
+        }
+        loaded.bind(key, Action(name - std::begin(action_names)));
+    }
+
+    *this = loaded;
+    return true;
+}
+
+
+bool InputBindings::lookup(const SDL_Keycode key, Action& action) const
+{
+    for (const std::pair<SDL_Keycode, Action>& binding : m_keys)
+    {
+        if (binding.first == key)
+        {
+            action = binding.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+Input::Input(const InputBindings& bindings, const double look_speed)
+    : m_bindings(bindings), m_look_speed(look_speed), m_tick(0), m_held(), m_quit(false), m_pending(),
+      m_recording(false), m_recorded(), m_replay(), m_replay_pos(0), m_oldest_pending(), m_oldest_applied()
+{
+}
+
+
+void Input::push(const InputCommand& command, const Clock::time_point time)
+{
+    if (m_pending.empty()) m_oldest_pending = time;
+
+    // A burst of mouse motion within one tick becomes a single command
+    if (command.type == InputCommand::look && !m_pending.empty() && m_pending.back().type == InputCommand::look)
+    {
+        int dx = m_pending.back().look_dx + command.look_dx;
+        if (dx >= INT16_MIN && dx <= INT16_MAX)
+        {
+            m_pending.back().look_dx = int16_t(dx);
+            return;
+        }
+    }
+    m_pending.push_back(command);
+}
+
+
+bool Input::poll()
+{
+    const Clock::time_point now = Clock::now();
+    const uint32_t now_ms = SDL_GetTicks();
+    SDL_Event event;
+
+    while (SDL_PollEvent(&event))
+    {
+        InputCommand command{m_tick, event.common.timestamp, 0, 0, 0};
+
+        if (event.type == SDL_QUIT)
+        {
+            m_quit = true;
+            continue;
+        }
+        else if (event.type == SDL_KEYDOWN || event.type == SDL_KEYUP)
+        {
+            Action action;
+            if (event.key.repeat || !m_bindings.lookup(event.key.keysym.sym, action)) continue;
+            if (action == Action::quit)
+            {
+                if (event.type == SDL_KEYDOWN) m_quit = true;
+                continue;
+            }
+            command.type = (event.type == SDL_KEYDOWN) ? InputCommand::press : InputCommand::release;
+            command.action = uint8_t(action);
+        }
+        else if (event.type == SDL_MOUSEMOTION)
+        {
+            command.type = InputCommand::look;
+            command.look_dx = int16_t(std::max<int>(INT16_MIN, std::min<int>(INT16_MAX, event.motion.xrel)));
+        }
+        else continue;
+
+        if (!m_replay.empty()) continue;
+
+        // SDL stamps events in milliseconds since it started; place them on our clock
+        const uint32_t age_ms = (now_ms >= command.time_ms) ? now_ms - command.time_ms : 0;
+        push(command, now - std::chrono::milliseconds(age_ms));
+    }
+
+    return !m_quit;
+}
+
+
+void Input::run(const InputCommand& command, Player& player)
+{
+    if (command.type == InputCommand::look)
+    {
+        player.direction += command.look_dx * m_look_speed;
+    }
+    else if (command.action < size_t(Action::count))
+    {
+        m_held[command.action] = (command.type == InputCommand::press);
+    }
+}
+
+
+void Input::apply(Player& player)
+{
+    if (!m_replay.empty())
+    {
+        for (; m_replay_pos < m_replay.size() && m_replay[m_replay_pos].tick <= m_tick; m_replay_pos++)
+            run(m_replay[m_replay_pos], player);
+    }
+    else if (!m_pending.empty())
+    {
+        for (const InputCommand& command : m_pending)
+            run(command, player);
+        if (m_recording) m_recorded.insert(m_recorded.end(), m_pending.begin(), m_pending.end());
+
+        if (m_oldest_applied == Clock::time_point()) m_oldest_applied = m_oldest_pending;
+        m_pending.clear();
+    }
+
+    player.walk = int(m_held[size_t(Action::forward)])    - int(m_held[size_t(Action::back)]);
+    player.turn = int(m_held[size_t(Action::turn_right)]) - int(m_held[size_t(Action::turn_left)]);
+    m_tick++;
+}
+
+
+void Input::start_recording()
+{
+    m_recording = true;
+    m_recorded.clear();
+}
+
+
+bool Input::save_recording(const std::string& filename) const
+{
+    RecordingHeader header{};
+    std::memcpy(header.magic, recording_magic, sizeof(recording_magic));
+    header.count = uint32_t(m_recorded.size());
+
+    std::ofstream ofs(filename, std::ios::binary);
+    ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    ofs.write(reinterpret_cast<const char*>(m_recorded.data()), m_recorded.size() * sizeof(InputCommand));
+
+    if (!ofs)
+    {
+        std::cerr << "Error: cannot write input recording " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+bool Input::load_replay(const std::string& filename)
+{
+    std::ifstream ifs(filename, std::ios::binary);
+    RecordingHeader header{};
+    ifs.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+    if (!ifs || std::memcmp(header.magic, recording_magic, sizeof(recording_magic)))
+    {
+        std::cerr << "Error: " << filename << " is not an input recording" << std::endl;
+        return false;
+    }
+
+    std::vector<InputCommand> commands(header.count);
+    ifs.read(reinterpret_cast<char*>(commands.data()), commands.size() * sizeof(InputCommand));
+    if (!ifs || commands.empty())
+    {
+        std::cerr << "Error: input recording " << filename << " is truncated or empty" << std::endl;
+        return false;
+    }
+
+    m_replay = std::move(commands);
+    m_replay_pos = 0;
+    m_pending.clear();
+    return true;
+}
+
+
+bool Input::replay_finished() const
+{
+    return !m_replay.empty() && m_replay_pos == m_replay.size();
+}
+
+
+bool Input::take_input_time(Clock::time_point& time)
+{
+    if (m_oldest_applied == Clock::time_point()) return false;
+    time = m_oldest_applied;
+    m_oldest_applied = Clock::time_point();
+    return true;
+}
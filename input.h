@@ -0,0 +1,110 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <chrono>
+#include "SDL.h"
+
+#include "player.h"
+
+
+enum class Action : uint8_t
+{
+    forward,
+    back,
+    turn_left,
+    turn_right,
+    quit,
+    count
+};
+
+
+// One input event as buffered between ticks and stored in recordings
+struct InputCommand
+{
+    enum Type : uint8_t { press, release, look };
+
+    uint32_t tick;     // Simulation tick the command is applied at
+    uint32_t time_ms;  // SDL timestamp of the event
+    uint8_t type;
+    uint8_t action;    // press and release: an Action
+    int16_t look_dx;   // look: relative horizontal mouse motion in pixels
+};
+static_assert(sizeof(InputCommand) == 12, "recordings store InputCommand as is");
+
+
+// Keys bound to actions. Defaults: w/s or up/down to walk, a/d or left/right to turn, escape to quit.
+class InputBindings
+{
+    std::vector<std::pair<SDL_Keycode, Action>> m_keys;
+
+public:
+    InputBindings();
+
+    void clear();
+    void bind(const SDL_Keycode key, const Action action);
+
+    // Replace the bindings with those of a text file, one "<SDL key name> <action>" per line with
+    // actions forward, back, turn_left, turn_right or quit, and # comments. On error the bindings
+    // are unchanged and the error is printed.
+    bool load(const std::string& filename);
+
+    bool lookup(const SDL_Keycode key, Action& action) const;
+};
+
+
+// Turns SDL events into InputCommands and the commands into player controls. poll() drains the
+// whole event queue; every command buffered since is applied at the next tick. The applied
+// commands can be recorded and written to a file, and a recording replayed in place of live input.
+//
+// Recording file: 16 byte header "FPSINPT1", uint32 command count, 4 reserved bytes, then the
+// InputCommands in order.
+class Input
+{
+    typedef std::chrono::steady_clock Clock;
+
+    InputBindings m_bindings;
+    double m_look_speed;                    // Radians per pixel of mouse motion
+    uint32_t m_tick;                        // Tick the next apply() runs
+    bool m_held[size_t(Action::count)];
+    bool m_quit;
+
+    std::vector<InputCommand> m_pending;    // Polled, not applied yet
+    bool m_recording;
+    std::vector<InputCommand> m_recorded;
+    std::vector<InputCommand> m_replay;
+    size_t m_replay_pos;
+
+    Clock::time_point m_oldest_pending;     // Time of the first pending command
+    Clock::time_point m_oldest_applied;     // Time of the first command applied since take_input_time()
+
+    void push(const InputCommand& command, const Clock::time_point time);
+    void run(const InputCommand& command, Player& player);
+
+public:
+    explicit Input(const InputBindings& bindings = InputBindings(), const double look_speed = 0.003);
+
+    // Drain the SDL event queue. False once quitting was asked for.
+    bool poll();
+
+    // Apply the commands of this tick to the player's controls and turn it by the mouse motion
+    void apply(Player& player);
+
+    void start_recording();
+    bool save_recording(const std::string& filename) const;
+
+    // Replay a recording: its commands are applied at the ticks they were recorded at and
+    // live key and mouse events are ignored (quit still works). False on error (printed).
+    bool load_replay(const std::string& filename);
+    bool replay_finished() const;
+
+    // Time of the oldest event applied since the previous call, for measuring input to photon
+    // latency; false if nothing was applied
+    bool take_input_time(Clock::time_point& time);
+};
+
+
+#endif
@@ -1,14 +1,25 @@
 #include <iostream>
 #include <vector>
 #include <SDL.h>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
 #include <chrono>
-#include <thread>
+#include <atomic>
+#include <memory>
 
 #include "render.h"
+#include "game_loop.h"
+#include "frame_pipeline.h"
+#include "input.h"
+#include "profiler.h"
 #include "utils.h"
+#include "capture.h"
+#include "flow_field.h"
 
 
-bool init(const FrameBuffer& frame_buf, const GameState& game_state, SDL_Window*& window, SDL_Renderer*& renderer, SDL_Texture*& framebuffer_texture)
+bool init(const size_t win_w, const size_t win_h, const GameState& game_state, SDL_Window*& window, SDL_Renderer*& renderer)
 {
     if (SDL_Init(SDL_INIT_VIDEO))
     {
@@ -22,17 +33,12 @@ bool init(const FrameBuffer& frame_buf, const GameState& game_state, SDL_Window*
         return false;
     }
 
-    if (SDL_CreateWindowAndRenderer(frame_buf.width(), frame_buf.height(), SDL_WINDOW_SHOWN | SDL_WINDOW_INPUT_FOCUS, &window, &renderer))
-    {
-        std::cerr << "Failed to create window and renderer: " << SDL_GetError() << std::endl;
-        return false;
-    }
+    const Player& player = game_state.player;
+    if (!game_state.map.validate(game_state.texture_walls.texture_count(), player.x_pos, player.y_pos)) return false;
 
-    framebuffer_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING, frame_buf.width(), frame_buf.height());
-    
-    if (!framebuffer_texture)
+    if (SDL_CreateWindowAndRenderer(win_w, win_h, SDL_WINDOW_SHOWN | SDL_WINDOW_INPUT_FOCUS, &window, &renderer))
     {
-        std::cerr << "Failed to create framebuffer texture : " << SDL_GetError() << std::endl;
+        std::cerr << "Failed to create window and renderer: " << SDL_GetError() << std::endl;
         return false;
     }
 
@@ -40,51 +46,168 @@ bool init(const FrameBuffer& frame_buf, const GameState& game_state, SDL_Window*
 }
 
 
-int main()
+int main(int argc, char** argv)
 {
-    FrameBuffer frame_buf(1024, 512, pack_colour(255, 255, 255));
-    GameState  game_state{ Map(),
+    // [--uncapped] [--tick-hz N] [--depth N] [--bindings FILE] [--record FILE | --replay FILE]
+    // [--profile] [--trace FILE] [--scale S | --target-ms T] [--texture-cache DIR] [--pvs] [--visibility-cache DIR]
+    // [--capture DIR | FILE.y4m] [--no-lighting]
+    // [level file, in the text or binary map format]
+    GameLoopSettings loop_settings;
+    size_t pipeline_depth = 2;  // Frames in flight between rendering and presenting
+    InputBindings bindings;
+    std::string record_file;
+    std::string replay_file;
+    bool show_profile = false;  // Profiler overlay on the 3D view
+    std::string trace_file;     // Chrome trace of the last frames, written on exit
+    RenderSettings render_settings;
+    TextureOptions texture_options;
+    texture_options.cache_dir = "texture_cache";  // Preprocessed textures, "" to always decode the bitmaps
+    texture_options.shade_levels = 16;            // Distance shading, faded to black
+    VisibilitySettings visibility_settings;
+    visibility_settings.cache_dir = "visibility_cache";  // Potentially visible sets, "" to always build them
+    std::string capture_path;   // Frames streamed to numbered PPMs in a directory, or to a .y4m file
+    std::string map_file;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--uncapped")                       loop_settings.frame_hz = 0;
+        else if (arg == "--tick-hz" && i + 1 < argc)   loop_settings.tick_hz = std::stod(argv[++i]);
+        else if (arg == "--depth" && i + 1 < argc)     pipeline_depth = std::max(1ul, std::stoul(argv[++i]));
+        else if (arg == "--record" && i + 1 < argc)    record_file = argv[++i];
+        else if (arg == "--replay" && i + 1 < argc)    replay_file = argv[++i];
+        else if (arg == "--profile")                   show_profile = true;
+        else if (arg == "--trace" && i + 1 < argc)     trace_file = argv[++i];
+        else if (arg == "--scale" && i + 1 < argc)     render_settings.render_scale = std::stod(argv[++i]);
+        else if (arg == "--target-ms" && i + 1 < argc) render_settings.target_ms = std::stod(argv[++i]);
+        else if (arg == "--texture-cache" && i + 1 < argc) texture_options.cache_dir = argv[++i];
+        else if (arg == "--pvs")                       render_settings.pvs = true;
+        else if (arg == "--visibility-cache" && i + 1 < argc) visibility_settings.cache_dir = argv[++i];
+        else if (arg == "--capture" && i + 1 < argc)   capture_path = argv[++i];
+        else if (arg == "--no-lighting")               render_settings.lighting = false, texture_options.shade_levels = 1;
+        else if (arg == "--bindings" && i + 1 < argc)
+        {
+            if (!bindings.load(argv[++i])) return -1;
+        }
+        else                                           map_file = arg;
+    }
+
+    Map map = map_file.empty() ? Map() : Map(map_file, true);
+    if (!map.width()) return -1;
+
+    const size_t win_w = 1024;
+    const size_t win_h = 512;
+    std::vector<Texture> textures = load_textures({"../walltext.bmp", "../monsters.bmp"}, SDL_PIXELFORMAT_ABGR8888,
+                                                  texture_options);
+    GameState  game_state{ map,
                            Player{3.456, 2.345, 1.523, M_PI/3., 0, 0},
-                           { {3.523, 3.812, 2, 0},  // vector of monster sprites
-                             {1.834, 8.765, 0, 0},
-                             {5.323, 5.365, 1, 0},
-                             {14.32, 13.36, 3, 0},
-                             {4.123, 10.76, 1, 0} },
-                           Texture("../walltext.bmp", SDL_PIXELFORMAT_ABGR8888), 
-                           Texture("../monsters.bmp", SDL_PIXELFORMAT_ABGR8888)};
+                           MonsterSystem({ {3.523, 3.812, 2},  // monsters, placed as sprites
+                                           {1.834, 8.765, 0},
+                                           {5.323, 5.365, 1},
+                                           {14.32, 13.36, 3},
+                                           {4.123, 10.76, 1} }),
+                           std::move(textures[0]),
+                           std::move(textures[1]),
+                           render_settings.pvs ? Visibility(map, visibility_settings) : Visibility()};
     
     SDL_Window*   window   = nullptr;
     SDL_Renderer* renderer = nullptr;
-    SDL_Texture*  framebuffer_texture = nullptr;
 
-    if (!init(frame_buf, game_state, window, renderer, framebuffer_texture)) return -1;
+    if (!init(win_w, win_h, game_state, window, renderer)) return -1;
+
+    Input input(bindings);
+    if (!replay_file.empty() && !input.load_replay(replay_file)) return -1;
+    if (!record_file.empty()) input.start_recording();
+    SDL_SetRelativeMouseMode(SDL_TRUE);  // Mouse look
+
+    Renderer game_renderer(render_settings);
+    ThreadPool monster_pool;  // Runs on the main thread's ticks, alongside the render thread's pool
+    FlowField flow;           // Paths to the player for the monsters, rebuilt on its own thread
+    Profiler::instance().set_enabled(show_profile || !trace_file.empty());
+
+    // What the render thread draws for each pipeline slot, copied from game_state on submit
+    std::vector<Player> cameras(pipeline_depth);
+    std::vector<std::vector<Sprite>> sprites(pipeline_depth);
+    std::atomic<double> render_scale{1};  // Written by the render thread, shown in the title
+
+    std::unique_ptr<FrameCapture> capture;
+    if (!capture_path.empty())
+    {
+        CaptureSettings capture_settings;
+        const bool y4m = capture_path.size() > 4 && capture_path.compare(capture_path.size() - 4, 4, ".y4m") == 0;
+        capture_settings.format = y4m ? CaptureFormat::y4m : CaptureFormat::ppm;
+        if (loop_settings.frame_hz > 0) capture_settings.fps = unsigned(loop_settings.frame_hz + 0.5);
+        capture.reset(new FrameCapture(capture_path, win_w, win_h, capture_settings));
+        if (!capture->valid()) return -1;
+    }
 
-    auto t1 = std::chrono::high_resolution_clock::now();
-    
-    while (true)
     {
-        // Sleep if less than 20 ms since last re-rendering
-        auto t2 = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double, std::milli> fp_ms = t2 - t1;
-        if (fp_ms.count()<20)
+        FramePipeline pipeline(renderer, win_w, win_h, pipeline_depth, [&](FrameBuffer& frame_buf, const size_t slot)
         {
-            std::this_thread::sleep_for(std::chrono::milliseconds(3));
-            continue;
-        }
-        t1 = t2;
+            game_renderer.render(frame_buf, game_state, cameras[slot], sprites[slot]);
+            render_scale.store(game_renderer.render_scale(), std::memory_order_relaxed);
+            if (show_profile) Profiler::instance().draw_overlay(frame_buf, win_w/2 + 8, 8);
+            if (capture) capture->push(frame_buf);
+        });
+        if (!pipeline.valid()) return -1;
+
+        GameLoop loop(loop_settings);
+        Player previous = game_state.player;  // Player as of the tick before the current one
+        uint64_t shown_windows = 0;           // Loop stats last shown in the window title
+
+        loop.run(
+            [&]()
+            {
+                PROFILE_SCOPE("input");
+                return input.poll();
+            },
+            [&]()
+            {
+                PROFILE_SCOPE("tick");
+                previous = game_state.player;
+                input.apply(game_state.player);
+                update_player_position(game_state);
+                flow.update(game_state.map, size_t(game_state.player.x_pos), size_t(game_state.player.y_pos));
+                game_state.monsters.update(game_state.map, game_state.player, monster_pool, &flow);
+            },
+            [&](const double alpha)
+            {
+                const size_t slot = pipeline.next_slot();
+                cameras[slot] = interpolate(previous, game_state.player, alpha);
+                game_state.monsters.sprites(sprites[slot]);  // Reuses the slot's capacity
+                std::chrono::steady_clock::time_point input_time;  // Left unset when no new input was applied
+                input.take_input_time(input_time);
+                pipeline.submit(input_time);
+                Profiler::instance().end_frame();
+                // Capped frames leave time to spare before the next one: present this frame now
+                // rather than one frame period later, behind the next submit
+                if (loop.settings().frame_hz > 0) pipeline.flush();
 
-        if (!update_player_state(game_state)) break;
-        update_player_position(game_state);
-        render(frame_buf, game_state);
+                if (loop.stats().windows != shown_windows)
+                {
+                    shown_windows = loop.stats().windows;
+                    std::ostringstream title;
+                    title << "fps " << int(loop.stats().frame_rate) << " | ticks/s " << int(loop.stats().tick_rate)
+                          << " | sleep " << int(loop.stats().sleep_ms) << " ms/s"
+                          << " | latency " << std::fixed << std::setprecision(1) << pipeline.stats().mean_latency_ms << " ms"
+                          << " | input to photon " << pipeline.stats().input_latency_ms << " ms"
+                          << " | scale " << std::setprecision(2) << render_scale.load(std::memory_order_relaxed);
+                    if (capture) title << " | capture dropped " << capture->frames_dropped()
+                                       << " failed " << capture->frames_failed();
+                    SDL_SetWindowTitle(window, title.str().c_str());
+                }
+            });
 
-        // Copy framebuffer contents to screen
-        SDL_UpdateTexture(framebuffer_texture, NULL, reinterpret_cast<const void*>(frame_buf.img().data()), frame_buf.width()*4);
-        SDL_RenderClear(renderer);
-        SDL_RenderCopy(renderer, framebuffer_texture, NULL, NULL);
-        SDL_RenderPresent(renderer);
+        pipeline.flush();
+    }
+
+    if (!record_file.empty()) input.save_recording(record_file);
+    if (!trace_file.empty()) Profiler::instance().write_trace(trace_file);
+    if (capture)
+    {
+        capture.reset();  // Waits for the queued frames
+        std::cout << "Captured frames to " << capture_path << std::endl;
     }
 
-    SDL_DestroyTexture(framebuffer_texture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -1,6 +1,12 @@
 #include <cassert>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
 
 #include "map.h"
+#include "utils.h"
 
 
 static const char map[] = "0000222222220000"\
@@ -21,32 +27,422 @@ static const char map[] = "0000222222220000"\
                           "0002222222200000";
 
 
-Map::Map()
-    : m_width(16), m_height(16)
+// Binary map file header, also kept at the front of the in-memory storage
+struct MapHeader
 {
-    assert(sizeof(map) == m_width*m_height + 1); // +1 for null terminated string
+    char magic[8];
+    uint32_t width;
+    uint32_t height;
+    uint32_t flags;
+    uint8_t reserved[12];
+};
+static_assert(sizeof(MapHeader) == 32, "map header must stay 32 bytes");
+
+static const char map_magic[8] = {'F', 'P', 'S', 'M', 'A', 'P', '1', '\0'};
+static const uint32_t flag_distance_field = 1;
+static const uint32_t flag_floor_layers   = 2;
+
+
+// Byte offsets of each section after the header, for a width x height map with the given flags.
+// Sections a flag leaves out take no space and have offset 0.
+struct MapLayout
+{
+    size_t words_per_row;
+    size_t walls;
+    size_t cells;
+    size_t field;
+    size_t floors;
+    size_t ceilings;
+    size_t size;
+
+    MapLayout(const size_t width, const size_t height, const uint32_t flags)
+    {
+        const size_t count = width * height;
+        words_per_row = (width + 63) / 64;
+        walls         = sizeof(MapHeader);
+        cells         = walls + words_per_row * height * sizeof(uint64_t);
+        size          = cells + count;
+        field = floors = ceilings = 0;
+
+        if (flags & flag_distance_field)
+        {
+            field = (size + 7) / 8 * 8;
+            size  = field + count;
+        }
+        if (flags & flag_floor_layers)
+        {
+            floors   = (size + 7) / 8 * 8;
+            ceilings = floors + count;
+            size     = ceilings + count;
+        }
+    }
+};
+
+
+// Texture id of a cell as written in a text map
+static uint8_t cell_id(const char c)
+{
+    return (c == ' ' || c == '.') ? Map::empty_cell : uint8_t(c - '0');
+}
+
+
+// Back to the text form, for rebuilding a loaded map
+static std::string cell_chars(const uint8_t* ids, const size_t count)
+{
+    std::string cells(count, ' ');
+    for (size_t k = 0; k < count; k++)
+        if (ids[k] != Map::empty_cell) cells[k] = char('0' + ids[k]);
+    return cells;
+}
+
+
+// Chebyshev distance transform: two raster passes over the 8-neighbourhood, with walls and
+// everything outside the map at distance 0
+static void build_distance_field(const Map& map, uint8_t* field)
+{
+    const size_t w = map.width();
+    const size_t h = map.height();
+    std::vector<uint16_t> dist(w * h);
+
+    auto at = [&](const long i, const long j) -> uint16_t
+    {
+        if (i < 0 || j < 0 || i >= long(w) || j >= long(h)) return 0;
+        return dist[i + j*w];
+    };
+
+    for (long j = 0; j < long(h); j++)
+    {
+        for (long i = 0; i < long(w); i++)
+        {
+            if (!map.is_empty(i, j)) { dist[i + j*w] = 0; continue; }
+            dist[i + j*w] = 1 + std::min({at(i-1, j), at(i-1, j-1), at(i, j-1), at(i+1, j-1)});
+        }
+    }
+
+    for (long j = long(h) - 1; j >= 0; j--)
+    {
+        for (long i = long(w) - 1; i >= 0; i--)
+        {
+            uint16_t d = 1 + std::min({at(i+1, j), at(i+1, j+1), at(i, j+1), at(i-1, j+1)});
+            dist[i + j*w] = std::min(dist[i + j*w], d);
+        }
+    }
+
+    for (size_t k = 0; k < w * h; k++)
+        field[k] = uint8_t(std::min<uint16_t>(dist[k], 255));
+}
+
+
+Map::Map(const bool distance_field)
+    : m_width(0), m_height(0), m_words_per_row(0), m_storage(), m_walls(nullptr), m_cells(nullptr),
+      m_field(nullptr), m_floors(nullptr), m_ceilings(nullptr), m_storage_bytes(0)
+{
+    assert(sizeof(map) == 16*16 + 1); // +1 for null terminated string
+    build(16, 16, std::string(map, 16*16), distance_field, std::string(16*16, '0'), std::string(16*16, '5'));
+}
+
+
+Map::Map(const size_t width, const size_t height, const std::string& cells, const bool distance_field,
+         const std::string& floors, const std::string& ceilings)
+    : m_width(0), m_height(0), m_words_per_row(0), m_storage(), m_walls(nullptr), m_cells(nullptr),
+      m_field(nullptr), m_floors(nullptr), m_ceilings(nullptr), m_storage_bytes(0)
+{
+    build(width, height, cells, distance_field, floors, ceilings);
+}
+
+
+Map::Map(const std::string& filename, const bool distance_field)
+    : m_width(0), m_height(0), m_words_per_row(0), m_storage(), m_walls(nullptr), m_cells(nullptr),
+      m_field(nullptr), m_floors(nullptr), m_ceilings(nullptr), m_storage_bytes(0)
+{
+    std::ifstream ifs(filename, std::ios::binary);
+    if (!ifs)
+    {
+        std::cerr << "Error: cannot open map " << filename << std::endl;
+        return;
+    }
+
+    char magic[sizeof(map_magic)] = {};
+    ifs.read(magic, sizeof(magic));
+    ifs.close();
+
+    if (!std::memcmp(magic, map_magic, sizeof(map_magic)))
+        load_binary(filename, distance_field);
+    else
+        load_text(filename, distance_field);
+}
+
+
+void Map::build(const size_t width, const size_t height, const std::string& cells, const bool distance_field,
+                const std::string& floors, const std::string& ceilings)
+{
+    assert(cells.size() == width * height);
+    assert(floors.empty() || floors.size() == width * height);
+    assert(ceilings.empty() || ceilings.size() == width * height);
+
+    const bool floor_layers = !floors.empty() || !ceilings.empty();
+    const uint32_t flags = (distance_field ? flag_distance_field : 0) | (floor_layers ? flag_floor_layers : 0);
+    const MapLayout layout(width, height, flags);
+
+    std::shared_ptr<std::vector<uint64_t>> buffer = std::make_shared<std::vector<uint64_t>>((layout.size + 7) / 8, 0);
+    uint8_t* base = reinterpret_cast<uint8_t*>(buffer->data());
+
+    MapHeader header{};
+    std::memcpy(header.magic, map_magic, sizeof(map_magic));
+    header.width  = uint32_t(width);
+    header.height = uint32_t(height);
+    header.flags  = flags;
+    std::memcpy(base, &header, sizeof(header));
+
+    uint64_t* walls = reinterpret_cast<uint64_t*>(base + layout.walls);
+    uint8_t* cell_ids = base + layout.cells;
+
+    for (size_t j = 0; j < height; j++)
+    {
+        for (size_t i = 0; i < width; i++)
+        {
+            uint8_t id = cell_id(cells[i + j*width]);
+            cell_ids[i + j*width] = id;
+            if (id != empty_cell) walls[j*layout.words_per_row + i/64] |= uint64_t(1) << (i%64);
+        }
+    }
+
+    // A layer left empty is untextured everywhere
+    if (floor_layers)
+    {
+        for (size_t k = 0; k < width * height; k++)
+        {
+            base[layout.floors + k]   = floors.empty()   ? empty_cell : cell_id(floors[k]);
+            base[layout.ceilings + k] = ceilings.empty() ? empty_cell : cell_id(ceilings[k]);
+        }
+    }
+
+    m_width         = width;
+    m_height        = height;
+    m_words_per_row = layout.words_per_row;
+    m_walls         = walls;
+    m_cells         = cell_ids;
+    m_field         = nullptr;
+    m_floors        = floor_layers ? base + layout.floors : nullptr;
+    m_ceilings      = floor_layers ? base + layout.ceilings : nullptr;
+    m_storage_bytes = layout.size;
+    m_storage       = std::shared_ptr<const void>(buffer, buffer->data());
+
+    if (distance_field)
+    {
+        build_distance_field(*this, base + layout.field);
+        m_field = base + layout.field;
+    }
+}
+
+
+bool Map::load_text(const std::string& filename, const bool distance_field)
+{
+    std::ifstream ifs(filename);
+    std::string cells;
+    std::string floors;
+    std::string ceilings;
+    std::string line;
+    size_t width = 0;
+    size_t height = 0;
+
+    // Rows go to the walls until a layer line switches to that layer
+    std::string* layer = &cells;
+    std::string layer_name = "walls";
+    size_t rows = 0;
+
+    auto check_rows = [&]()
+    {
+        if (layer == &cells || rows == height) return true;
+        std::cerr << "Error: map " << filename << " " << layer_name << " layer has " << rows
+                  << " rows, expected " << height << std::endl;
+        return false;
+    };
+
+    while (std::getline(ifs, line))
+    {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) continue;
+
+        if (line == "[floor]" || line == "[ceiling]")
+        {
+            if (!check_rows()) return false;
+            layer = (line == "[floor]") ? &floors : &ceilings;
+            layer_name = line.substr(1, line.size() - 2);
+            layer->clear();
+            rows = 0;
+            continue;
+        }
+
+        if (height && line.size() != width)
+        {
+            std::cerr << "Error: map " << filename << " " << layer_name << " row " << rows << " is " << line.size()
+                      << " cells wide, expected " << width << std::endl;
+            return false;
+        }
+
+        for (char c : line)
+        {
+            if (c != ' ' && c != '.' && (c < '0' || c > '9'))
+            {
+                std::cerr << "Error: map " << filename << " has invalid cell '" << c << "'" << std::endl;
+                return false;
+            }
+        }
+
+        width = line.size();
+        *layer += line;
+        rows++;
+        if (layer == &cells) height = rows;
+    }
+
+    if (!width || !height)
+    {
+        std::cerr << "Error: map " << filename << " is empty" << std::endl;
+        return false;
+    }
+    if (!check_rows()) return false;
+
+    build(width, height, cells, distance_field, floors, ceilings);
+    return true;
+}
+
+
+bool Map::load_binary(const std::string& filename, const bool distance_field)
+{
+    size_t file_size = 0;
+    std::shared_ptr<const void> storage = map_file(filename, file_size);
+
+    MapHeader header{};
+    if (file_size >= sizeof(header)) std::memcpy(&header, static_cast<const uint8_t*>(storage.get()), sizeof(header));
+
+    const MapLayout layout(header.width, header.height, header.flags);
+    const bool has_field = header.flags & flag_distance_field;
+    const bool has_layers = header.flags & flag_floor_layers;
+
+    if (!header.width || !header.height || file_size < layout.size)
+    {
+        std::cerr << "Error: binary map " << filename << " is truncated or corrupt" << std::endl;
+        return false;
+    }
+
+    // The bitset and the cell ids must agree, as is_empty() reads one and get() the other
+    const uint8_t* base = static_cast<const uint8_t*>(storage.get());
+    const uint64_t* walls = reinterpret_cast<const uint64_t*>(base + layout.walls);
+    for (size_t j = 0; j < header.height; j++)
+    {
+        for (size_t i = 0; i < header.width; i++)
+        {
+            const bool wall = (walls[j*layout.words_per_row + i/64] >> (i%64)) & 1;
+            if (wall != (base[layout.cells + i + j*header.width] != empty_cell))
+            {
+                std::cerr << "Error: binary map " << filename << " cell (" << i << "," << j
+                          << ") does not match its wall bit" << std::endl;
+                return false;
+            }
+        }
+    }
+
+    m_width         = header.width;
+    m_height        = header.height;
+    m_words_per_row = layout.words_per_row;
+    m_walls         = walls;
+    m_cells         = base + layout.cells;
+    m_field         = has_field ? base + layout.field : nullptr;
+    m_floors        = has_layers ? base + layout.floors : nullptr;
+    m_ceilings      = has_layers ? base + layout.ceilings : nullptr;
+    m_storage_bytes = layout.size;
+    m_storage       = storage;
+
+    // The file has no field: rebuild into memory with one
+    if (distance_field && !has_field)
+    {
+        const size_t count = m_width * m_height;
+        build(m_width, m_height, cell_chars(m_cells, count), true,
+              has_layers ? cell_chars(m_floors, count) : std::string(),
+              has_layers ? cell_chars(m_ceilings, count) : std::string());
+    }
+
+    return true;
+}
+
+
+bool Map::save(const std::string& filename) const
+{
+    std::ofstream ofs(filename, std::ios::binary);
+    ofs.write(static_cast<const char*>(m_storage.get()), m_storage_bytes);
+
+    if (!ofs)
+    {
+        std::cerr << "Error: cannot write map " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+bool Map::validate(const size_t texture_count, const double spawn_x, const double spawn_y) const
+{
+    static const char* const layers[3] = {"wall", "floor", "ceiling"};
+    for (size_t j = 0; j < m_height; j++)
+    {
+        for (size_t i = 0; i < m_width; i++)
+        {
+            const size_t k = i + j*m_width;
+            const uint8_t ids[3] = {m_cells[k], m_floors ? m_floors[k] : empty_cell, m_ceilings ? m_ceilings[k] : empty_cell};
+            for (size_t layer = 0; layer < 3; layer++)
+            {
+                if (ids[layer] == empty_cell || ids[layer] < texture_count) continue;
+                std::cerr << "Error: map cell (" << i << "," << j << ") " << layers[layer] << " uses wall texture "
+                          << int(ids[layer]) << ", only " << texture_count << " are loaded" << std::endl;
+                return false;
+            }
+        }
+    }
+
+    if (spawn_x < 0 || spawn_y < 0 || spawn_x >= m_width || spawn_y >= m_height || !is_empty(spawn_x, spawn_y))
+    {
+        std::cerr << "Error: the player starts at (" << spawn_x << "," << spawn_y << "), outside the "
+                  << m_width << "x" << m_height << " map or inside a wall" << std::endl;
+        return false;
+    }
+    return true;
 }
 
 
 size_t Map::width()  const { return m_width; }
 size_t Map::height() const { return m_height; }
+size_t Map::memory_bytes() const { return m_storage_bytes; }
+bool Map::has_distance_field() const { return m_field != nullptr; }
+bool Map::has_floor_layers() const { return m_floors != nullptr; }
 
 
-int Map::get(const size_t i, const size_t j) const
+uint64_t Map::wall_hash() const
 {
-    assert(sizeof(map) == m_width*m_height + 1
-           && i < m_width 
-           && j < m_height);
-           
-    return map[i + j*m_width] - '0';
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&hash](const uint64_t word)
+    {
+        hash ^= word;
+        hash *= 1099511628211ull;
+    };
+
+    mix(m_width);
+    mix(m_height);
+    for (size_t k = 0; k < m_words_per_row * m_height; k++)
+        mix(m_walls[k]);
+    return hash;
 }
 
 
-bool Map::is_empty(const size_t i, const size_t j) const
+int Map::get(const size_t i, const size_t j) const
 {
-    assert(sizeof(map) == m_width*m_height+1
-           && i < m_width 
-           && j < m_height);
+    assert(i < m_width && j < m_height && m_cells[i + j*m_width] != empty_cell);
+    return m_cells[i + j*m_width];
+}
+
 
-    return map[i + j*m_width] == ' ';
-}
\ No newline at end of file
+uint8_t Map::empty_radius(const size_t i, const size_t j) const
+{
+    assert(i < m_width && j < m_height && m_field);
+    return m_field[i + j*m_width];
+}
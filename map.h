@@ -2,22 +2,105 @@
 #define MAP_H
 
 #include <cstdlib>
+#include <cstdint>
+#include <cassert>
+#include <string>
+#include <memory>
 
 
+// Grid of cells, each either empty or a wall textured with one of the wall textures. Maps may also
+// have floor and ceiling layers: per cell, the wall texture drawn on the floor and on the ceiling.
+//
+// Map files are either text, one line per row with ' ' or '.' for empty cells and '0'-'9' for
+// walls, or the binary format written by save(). In a text map, the rows after a "[floor]" or a
+// "[ceiling]" line give that layer in the same way, ' ' or '.' leaving the cell untextured.
+// The binary file holds the same layout Map keeps in memory, so it is mapped read-only and used
+// in place rather than parsed:
+//   32 byte header: "FPSMAP1\0", uint32 width, uint32 height, uint32 flags, 12 reserved bytes
+//   occupancy bitset, one bit per cell (1 = wall), each row padded to whole 64 bit words
+//   one byte per cell: wall texture id, or empty_cell
+//   with flag_distance_field, padded to 8 bytes: one byte per cell, distance field (see empty_radius)
+//   with flag_floor_layers, padded to 8 bytes: one byte per cell floor texture id, then the same
+//   for the ceiling, empty_cell where untextured
 class Map
 {
     size_t m_width;
     size_t m_height;
+    size_t m_words_per_row;
+
+    std::shared_ptr<const void> m_storage;  // Heap buffer or file mapping holding the data below
+    const uint64_t* m_walls;
+    const uint8_t* m_cells;
+    const uint8_t* m_field;                 // nullptr without a distance field
+    const uint8_t* m_floors;                // nullptr without floor layers
+    const uint8_t* m_ceilings;
+    size_t m_storage_bytes;
+
+    void build(const size_t width, const size_t height, const std::string& cells, const bool distance_field,
+               const std::string& floors, const std::string& ceilings);
+    bool load_binary(const std::string& filename, const bool distance_field);
+    bool load_text(const std::string& filename, const bool distance_field);
 
 public:
-    Map();
+    static const uint8_t empty_cell = 255;
+
+    // The built-in 16x16 level
+    explicit Map(const bool distance_field = false);
+
+    // Cells given as in a text map file, row after row. floors and ceilings are the layers in the
+    // same form, or both empty for a map without them.
+    Map(const size_t width, const size_t height, const std::string& cells, const bool distance_field = false,
+        const std::string& floors = "", const std::string& ceilings = "");
+
+    // Load a text or binary map file. On failure the map is 0x0 and the error is printed.
+    // With distance_field, a field is built if the file does not already hold one.
+    explicit Map(const std::string& filename, const bool distance_field = false);
+
+    // Write the binary format (with the distance field if the map has one)
+    bool save(const std::string& filename) const;
+
+    // Whether the map can be played with texture_count wall textures and the player starting at
+    // (spawn_x, spawn_y): every wall, floor and ceiling id names a texture and the spawn lies in
+    // an empty cell.
+    // Prints the first problem found.
+    bool validate(const size_t texture_count, const double spawn_x, const double spawn_y) const;
 
     size_t width() const;
     size_t height() const;
+    size_t memory_bytes() const;
+
+    // FNV-1a over the size and the occupancy bitset: equal for maps with the same walls, whatever
+    // their file format, texture ids or layers. Keys data derived from the walls alone.
+    uint64_t wall_hash() const;
 
     int get(const size_t i, const size_t j) const;
-    bool is_empty(const size_t i, const size_t j) const;
+
+    bool is_empty(const size_t i, const size_t j) const
+    {
+        assert(i < m_width && j < m_height);
+        return !((m_walls[j*m_words_per_row + i/64] >> (i%64)) & 1);
+    }
+
+    // Chebyshev distance in cells from (i,j) to the nearest wall or the map border, capped at 255:
+    // every cell less than empty_radius(i,j) cells away from (i,j) along both axes is empty
+    bool has_distance_field() const;
+    uint8_t empty_radius(const size_t i, const size_t j) const;
+
+    // Texture ids of the floor and the ceiling of cell (i,j), empty_cell where untextured
+    bool has_floor_layers() const;
+
+    uint8_t floor_texture(const size_t i, const size_t j) const
+    {
+        assert(i < m_width && j < m_height && m_floors);
+        return m_floors[i + j*m_width];
+    }
+
+    uint8_t ceiling_texture(const size_t i, const size_t j) const
+    {
+        assert(i < m_width && j < m_height && m_ceilings);
+        return m_ceilings[i + j*m_width];
+    }
 };
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,236 @@
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <cstring>
+
+#include "monsters.h"
+
+// SSE2 is part of x86-64, so no runtime check is needed
+#if defined(__SSE2__)
+#define MONSTERS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+
+// xorshift32: cheap enough to step for every monster every tick, also four at a time in SSE2
+static uint32_t next_random(const uint32_t state)
+{
+    uint32_t r = state;
+    r ^= r << 13;
+    r ^= r >> 17;
+    r ^= r << 5;
+    return r;
+}
+
+
+// Random direction of length speed from two bytes of r
+static void random_heading(const uint32_t r, const float speed, float& vx, float& vy)
+{
+    const float hx = float(int((r >> 8) & 255) - 128) + 0.5f;
+    const float hy = float(int((r >> 16) & 255) - 128) + 0.5f;
+    const float scale = speed / std::sqrt(hx*hx + hy*hy);
+    vx = hx * scale;
+    vy = hy * scale;
+}
+
+
+// Whether the point (x,y) is in an empty cell of the w x h map, outside counting as a wall
+static bool is_open(const Map& map, const size_t w, const size_t h, const float x, const float y)
+{
+    if (!(x >= 0 && y >= 0)) return false;
+    const size_t i = size_t(int64_t(x));  // Through a signed type, which converts in one instruction
+    const size_t j = size_t(int64_t(y));
+    return i < w && j < h && map.is_empty(i, j);
+}
+
+
+MonsterSystem::MonsterSystem(const MonsterSettings& settings)
+    : m_settings(settings), m_x(), m_y(), m_vx(), m_vy(), m_state(), m_texture(), m_random()
+{
+}
+
+
+MonsterSystem::MonsterSystem(const std::vector<Sprite>& sprites, const MonsterSettings& settings)
+    : MonsterSystem(settings)
+{
+    for (const Sprite& sprite : sprites)
+        add(sprite.x_pos, sprite.y_pos, sprite.texture_id);
+}
+
+
+MonsterSettings& MonsterSystem::settings() { return m_settings; }
+size_t MonsterSystem::size() const { return m_x.size(); }
+double MonsterSystem::x(const size_t monster) const { return m_x[monster]; }
+double MonsterSystem::y(const size_t monster) const { return m_y[monster]; }
+MonsterState MonsterSystem::state(const size_t monster) const { return m_state[monster]; }
+
+
+void MonsterSystem::add(const double x, const double y, const size_t texture_id)
+{
+    // Seeded from the index (never 0, which xorshift cannot leave), so a level plays the same every time
+    const uint32_t random = next_random(uint32_t(m_x.size() + 1) * 2654435761u);
+    float vx, vy;
+    random_heading(random, m_settings.wander_speed, vx, vy);
+
+    m_x.push_back(float(x));
+    m_y.push_back(float(y));
+    m_vx.push_back(vx);
+    m_vy.push_back(vy);
+    m_state.push_back(MonsterState::wander);
+    m_texture.push_back(uint32_t(texture_id));
+    m_random.push_back(random);
+}
+
+
+void MonsterSystem::steer(const size_t begin, const size_t end, const float player_x, const float player_y)
+{
+    const float* x = m_x.data();
+    const float* y = m_y.data();
+    float* vx = m_vx.data();
+    float* vy = m_vy.data();
+    MonsterState* state = m_state.data();
+    uint32_t* random = m_random.data();
+
+    const float chase_sq = m_settings.chase_radius * m_settings.chase_radius;
+    const float stop_sq = m_settings.stop_radius * m_settings.stop_radius;
+    const float chase_speed = m_settings.chase_speed;
+    const float wander_speed = m_settings.wander_speed;
+    const uint32_t turn_below = std::numeric_limits<uint32_t>::max() / std::max(1u, m_settings.turn_odds);
+
+    size_t k = begin;
+
+#ifdef MONSTERS_SSE2
+    // Four monsters per step, the same operations as the loop below so both give the same result.
+    // std::sqrt may set errno, which keeps the compiler from vectorizing that loop itself.
+    const __m128 px = _mm_set1_ps(player_x);
+    const __m128 py = _mm_set1_ps(player_y);
+    const __m128i byte = _mm_set1_epi32(255);
+    const __m128i sign = _mm_set1_epi32(int32_t(0x80000000u));
+    const __m128i turn_limit = _mm_xor_si128(_mm_set1_epi32(int32_t(turn_below)), sign);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i offset = _mm_set1_epi32(128);
+    const __m128 half = _mm_set1_ps(0.5f);
+
+    auto select = [](const __m128 mask, const __m128 a, const __m128 b)
+    {
+        return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    };
+
+    for (; k + 4 <= end; k += 4)
+    {
+        __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(random + k));
+        r = _mm_xor_si128(r, _mm_slli_epi32(r, 13));
+        r = _mm_xor_si128(r, _mm_srli_epi32(r, 17));
+        r = _mm_xor_si128(r, _mm_slli_epi32(r, 5));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(random + k), r);
+
+        const __m128 dx = _mm_sub_ps(px, _mm_loadu_ps(x + k));
+        const __m128 dy = _mm_sub_ps(py, _mm_loadu_ps(y + k));
+        const __m128 dist_sq = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        const __m128 chase = _mm_cmplt_ps(dist_sq, _mm_set1_ps(chase_sq));
+        const __m128 chase_scale = _mm_and_ps(_mm_cmpgt_ps(dist_sq, _mm_set1_ps(stop_sq)),
+                                              _mm_div_ps(_mm_set1_ps(chase_speed), _mm_sqrt_ps(dist_sq)));
+
+        const __m128 hx0 = _mm_add_ps(_mm_cvtepi32_ps(_mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(r, 8), byte), offset)), half);
+        const __m128 hy0 = _mm_add_ps(_mm_cvtepi32_ps(_mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(r, 16), byte), offset)), half);
+        const __m128 h_scale = _mm_div_ps(_mm_set1_ps(wander_speed),
+                                          _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(hx0, hx0), _mm_mul_ps(hy0, hy0))));
+        const __m128 hx = _mm_mul_ps(hx0, h_scale);
+        const __m128 hy = _mm_mul_ps(hy0, h_scale);
+
+        // Four state bytes widened to one lane each; unsigned r < turn_below as a signed compare
+        int32_t state_bytes;
+        std::memcpy(&state_bytes, state + k, 4);
+        const __m128i state32 = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(state_bytes), zero), zero);
+        const __m128i wandering = _mm_cmpeq_epi32(state32, _mm_set1_epi32(int32_t(MonsterState::wander)));
+        const __m128 turn = _mm_castsi128_ps(_mm_or_si128(_mm_cmplt_epi32(_mm_xor_si128(r, sign), turn_limit),
+                                                          _mm_andnot_si128(wandering, _mm_set1_epi32(-1))));
+
+        const __m128 wx = select(turn, hx, _mm_loadu_ps(vx + k));
+        const __m128 wy = select(turn, hy, _mm_loadu_ps(vy + k));
+        _mm_storeu_ps(vx + k, select(chase, _mm_mul_ps(dx, chase_scale), wx));
+        _mm_storeu_ps(vy + k, select(chase, _mm_mul_ps(dy, chase_scale), wy));
+
+        const __m128i new_state = _mm_and_si128(_mm_castps_si128(chase), _mm_set1_epi32(int32_t(MonsterState::chase)));
+        state_bytes = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(new_state, zero), zero));
+        std::memcpy(state + k, &state_bytes, 4);
+    }
+#endif
+
+    // Both behaviours are computed for every monster and one is selected, so there is no branch
+    for (; k < end; k++)
+    {
+        const uint32_t r = next_random(random[k]);
+        random[k] = r;
+
+        const float dx = player_x - x[k];
+        const float dy = player_y - y[k];
+        const float dist_sq = dx*dx + dy*dy;
+        const bool chase = dist_sq < chase_sq;
+        const float chase_scale = dist_sq > stop_sq ? chase_speed / std::sqrt(dist_sq) : 0.f;
+
+        // A monster giving up a chase turns too, back to the wandering speed
+        float hx, hy;
+        random_heading(r, wander_speed, hx, hy);
+        const bool turn = r < turn_below || state[k] != MonsterState::wander;
+        const float wx = turn ? hx : vx[k];
+        const float wy = turn ? hy : vy[k];
+
+        vx[k] = chase ? dx * chase_scale : wx;
+        vy[k] = chase ? dy * chase_scale : wy;
+        state[k] = chase ? MonsterState::chase : MonsterState::wander;
+    }
+}
+
+
+void MonsterSystem::move(const Map& map, const FlowField* flow, const size_t begin, const size_t end)
+{
+    const size_t w = map.width();
+    const size_t h = map.height();
+    const float radius = m_settings.radius;
+    const float chase_speed = m_settings.chase_speed;
+
+    // One axis at a time, so monsters slide along walls; a blocked axis bounces back
+    for (size_t k = begin; k < end; k++)
+    {
+        // Around walls rather than into them; straight at the player once in their cell
+        if (flow && m_state[k] == MonsterState::chase)
+        {
+            const uint8_t step = flow->step(size_t(int64_t(m_x[k])), size_t(int64_t(m_y[k])));
+            if (step != FlowField::no_step)
+            {
+                m_vx[k] = FlowField::step_x[step] * chase_speed;
+                m_vy[k] = FlowField::step_y[step] * chase_speed;
+            }
+        }
+
+        const float x = m_x[k] + m_vx[k];
+        if (is_open(map, w, h, x + std::copysign(radius, m_vx[k]), m_y[k])) m_x[k] = x;
+        else m_vx[k] = -m_vx[k];
+
+        const float y = m_y[k] + m_vy[k];
+        if (is_open(map, w, h, m_x[k], y + std::copysign(radius, m_vy[k]))) m_y[k] = y;
+        else m_vy[k] = -m_vy[k];
+    }
+}
+
+
+void MonsterSystem::update(const Map& map, const Player& player, ThreadPool& pool, const FlowField* flow)
+{
+    const float player_x = float(player.x_pos);
+    const float player_y = float(player.y_pos);
+
+    pool.parallel_for(size(), m_settings.grain, [&](size_t begin, size_t end)
+    {
+        steer(begin, end, player_x, player_y);
+        move(map, flow, begin, end);
+    });
+}
+
+
+void MonsterSystem::sprites(std::vector<Sprite>& sprites) const
+{
+    sprites.resize(size());
+    for (size_t k = 0; k < size(); k++)
+        sprites[k] = Sprite{m_x[k], m_y[k], m_texture[k]};
+}
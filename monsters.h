@@ -0,0 +1,79 @@
+#ifndef MONSTERS_H
+#define MONSTERS_H
+
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+
+#include "map.h"
+#include "player.h"
+#include "sprite.h"
+#include "thread_pool.h"
+#include "flow_field.h"
+
+
+enum class MonsterState : uint8_t
+{
+    wander,  // Straight ahead, picking a new random heading now and then or when blocked
+    chase    // Heading for the player, who is within chase_radius: along the flow field when there is one
+};
+
+
+struct MonsterSettings
+{
+    float wander_speed = 0.02f;  // Cells per tick
+    float chase_speed  = 0.035f;
+    float chase_radius = 6;      // Monsters closer than this to the player chase them
+    float stop_radius  = 0.6f;   // and stop this close
+    float radius       = 0.2f;   // Half the side of a monster's square against the walls
+    unsigned turn_odds = 64;     // A wandering monster picks a new heading once every turn_odds ticks on average
+    size_t grain       = 4096;   // Monsters per work-stealing chunk
+};
+
+
+// Every monster of the level, stored as structure of arrays: one array per field, indexed by
+// monster. A tick runs over contiguous chunks of the arrays on a thread pool, in two passes per
+// chunk: steering, branch-free float arithmetic done four monsters at a time, then moving each
+// monster one axis at a time against the map occupancy bitset. Every monster only reads its own
+// state, the map and the player, so the result does not depend on the thread count.
+//
+// Nothing is sorted per tick: the renderer orders the few sprites it draws itself.
+class MonsterSystem
+{
+    MonsterSettings m_settings;
+
+    std::vector<float> m_x;
+    std::vector<float> m_y;
+    std::vector<float> m_vx;          // Cells per tick
+    std::vector<float> m_vy;
+    std::vector<MonsterState> m_state;
+    std::vector<uint32_t> m_texture;
+    std::vector<uint32_t> m_random;   // Per monster xorshift32 state
+
+    void steer(const size_t begin, const size_t end, const float player_x, const float player_y);
+    void move(const Map& map, const FlowField* flow, const size_t begin, const size_t end);
+
+public:
+    explicit MonsterSystem(const MonsterSettings& settings = MonsterSettings());
+
+    // One wandering monster per sprite, at its position and with its texture
+    explicit MonsterSystem(const std::vector<Sprite>& sprites, const MonsterSettings& settings = MonsterSettings());
+
+    MonsterSettings& settings();
+
+    void add(const double x, const double y, const size_t texture_id);
+    size_t size() const;
+
+    double x(const size_t monster) const;
+    double y(const size_t monster) const;
+    MonsterState state(const size_t monster) const;
+
+    // Advance every monster by one tick. flow, when given, should lead to the player's cell.
+    void update(const Map& map, const Player& player, ThreadPool& pool, const FlowField* flow = nullptr);
+
+    // The monsters as sprites, in monster order, reusing the capacity of sprites
+    void sprites(std::vector<Sprite>& sprites) const;
+};
+
+
+#endif
@@ -13,4 +13,16 @@ struct Player
 };
 
 
+// Player state a fraction alpha of the way from previous to current, to render between two
+// simulation ticks. Direction is not wrapped, so plain linear interpolation is correct.
+inline Player interpolate(const Player& previous, const Player& current, const double alpha)
+{
+    Player player = current;
+    player.x_pos     = previous.x_pos     + (current.x_pos     - previous.x_pos)     * alpha;
+    player.y_pos     = previous.y_pos     + (current.y_pos     - previous.y_pos)     * alpha;
+    player.direction = previous.direction + (current.direction - previous.direction) * alpha;
+    return player;
+}
+
+
 #endif
\ No newline at end of file
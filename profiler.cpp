@@ -0,0 +1,209 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <iomanip>
+#include <algorithm>
+
+#include "utils.h"
+#include "profiler.h"
+
+
+static const std::chrono::steady_clock::time_point g_epoch = std::chrono::steady_clock::now();
+
+
+// Small ids for the threads that record events, in order of their first event
+static uint32_t thread_index()
+{
+    static std::atomic<uint32_t> next{0};
+    thread_local uint32_t index = next.fetch_add(1, std::memory_order_relaxed);
+    return index;
+}
+
+
+Profiler& Profiler::instance()
+{
+    static Profiler profiler;
+    return profiler;
+}
+
+
+Profiler::Profiler()
+    : m_enabled(false), m_zone_mtx(), m_zone_count(0), m_zone_names(), m_frames(0), m_events(), m_event_count(0)
+{
+    for (size_t z = 0; z < max_zones; z++)
+    {
+        m_current[z].store(0, std::memory_order_relaxed);
+        for (size_t f = 0; f < frame_history; f++)
+            m_history[f][z].store(0, std::memory_order_relaxed);
+    }
+}
+
+
+size_t Profiler::zone(const char* name)
+{
+    std::lock_guard<std::mutex> lock(m_zone_mtx);
+
+    const size_t count = m_zone_count.load(std::memory_order_relaxed);
+    for (size_t z = 0; z < count; z++)
+        if (!std::strcmp(m_zone_names[z], name)) return z;
+
+    if (count == max_zones)
+    {
+        std::cerr << "Error: more than " << max_zones << " profiler zones, " << name << " shares the last one" << std::endl;
+        return max_zones - 1;
+    }
+
+    m_zone_names[count] = name;
+    m_zone_count.store(count + 1, std::memory_order_release);
+    return count;
+}
+
+
+void Profiler::set_enabled(const bool enabled) { m_enabled.store(enabled, std::memory_order_relaxed); }
+
+
+uint64_t Profiler::now_ns() const
+{
+    // Never 0, which ScopedTimer reserves for "not timing"
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - g_epoch).count()) + 1;
+}
+
+
+void Profiler::record(const size_t zone, const uint64_t start_ns, const uint64_t end_ns)
+{
+    m_current[zone].fetch_add(end_ns - start_ns, std::memory_order_relaxed);
+
+    TraceEvent& event = m_events[m_event_count.fetch_add(1, std::memory_order_relaxed) % max_events];
+    event.zone     = uint32_t(zone);
+    event.thread   = thread_index();
+    event.start_ns = start_ns;
+    event.end_ns   = end_ns;
+}
+
+
+void Profiler::end_frame()
+{
+    const uint64_t frame = m_frames.load(std::memory_order_relaxed);
+    for (size_t z = 0; z < max_zones; z++)
+        m_history[frame % frame_history][z].store(m_current[z].exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+    m_frames.store(frame + 1, std::memory_order_release);
+}
+
+
+size_t Profiler::zone_count() const { return m_zone_count.load(std::memory_order_acquire); }
+const char* Profiler::zone_name(const size_t zone) const { return m_zone_names[zone]; }
+
+
+double Profiler::zone_ms(const size_t zone) const
+{
+    const size_t frames = size_t(std::min<uint64_t>(m_frames.load(std::memory_order_acquire), frame_history));
+    if (!frames) return 0;
+
+    uint64_t total = 0;
+    for (size_t f = 0; f < frames; f++)
+        total += m_history[f][zone].load(std::memory_order_relaxed);
+    return double(total) / frames * 1e-6;
+}
+
+
+// 3x5 pixel glyphs, rows top to bottom, '1' = lit. Lower case letters are drawn as capitals.
+static const char* glyph(const char c)
+{
+    static const char* const digits[10] = {
+        "111101101101111", "010110010010111", "111001111100111", "111001111001111", "101101111001001",
+        "111100111001111", "111100111101111", "111001001001001", "111101111101111", "111101111001111"};
+    static const char* const letters[26] = {
+        "010101111101101", "110101110101110", "011100100100011", "110101101101110", "111100110100111",
+        "111100110100100", "011100101101011", "101101111101101", "111010010010111", "001001001101010",
+        "101101110101101", "100100100100111", "101111111101101", "110101101101101", "010101101101010",
+        "110101110100100", "010101101110011", "110101110101101", "011100010001110", "111010010010010",
+        "101101101101111", "101101101101010", "101101111111101", "101101010101101", "101101010010010",
+        "111001010100111"};
+
+    if (c >= '0' && c <= '9') return digits[c - '0'];
+    if (c >= 'a' && c <= 'z') return letters[c - 'a'];
+    if (c >= 'A' && c <= 'Z') return letters[c - 'A'];
+    switch (c)
+    {
+        case '.': return "000000000000010";
+        case '_': return "000000000000111";
+        case '-': return "000000111000000";
+        case ':': return "000010000010000";
+        case '/': return "001001010100100";
+        default:  return "000000000000000";
+    }
+}
+
+
+// Text at (x, y), each glyph pixel scale x scale, clipped to the framebuffer
+static void draw_text(FrameBuffer& frame_buf, const size_t x, const size_t y, const char* text, const size_t scale,
+                      const uint32_t colour)
+{
+    for (size_t k = 0; text[k]; k++)
+    {
+        const char* bits = glyph(text[k]);
+        for (size_t row = 0; row < 5; row++)
+            for (size_t col = 0; col < 3; col++)
+                if (bits[row*3 + col] == '1')
+                    frame_buf.draw_rectangle(x + (k*4 + col)*scale, y + row*scale, scale, scale, colour);
+    }
+}
+
+
+void Profiler::draw_overlay(FrameBuffer& frame_buf, const size_t x, const size_t y, const size_t bar_ms_px) const
+{
+    const size_t scale = 2;
+    const size_t line_h = 7 * scale;
+    const size_t label_w = 18 * 4 * scale;  // Room for 18 characters
+    const size_t value_w = 7 * 4 * scale;
+    const size_t zones = zone_count();
+
+    // Darken the panel so the text stays readable over the scene
+    const size_t panel_w = std::min(frame_buf.width() - std::min(x, frame_buf.width()), label_w + value_w + 10 * bar_ms_px);
+    const size_t panel_h = std::min(frame_buf.height() - std::min(y, frame_buf.height()), zones * line_h + 2 * scale);
+    for (size_t j = 0; panel_w && j < panel_h; j++)
+    {
+        uint32_t* row = frame_buf.pixel_ptr(x, y + j);
+        for (size_t i = 0; i < panel_w; i++)
+            row[i] = ((row[i] >> 2) & 0x003f3f3f) | (row[i] & 0xff000000);
+    }
+
+    for (size_t z = 0; z < zones; z++)
+    {
+        const size_t line_y = y + scale + z * line_h;
+        const double ms = zone_ms(z);
+        char value[16];
+        std::snprintf(value, sizeof(value), "%6.3f", ms);
+
+        draw_text(frame_buf, x + scale, line_y, zone_name(z), scale, pack_colour(255, 255, 255));
+        draw_text(frame_buf, x + label_w, line_y, value, scale, pack_colour(255, 255, 160));
+        frame_buf.draw_rectangle(x + label_w + value_w, line_y, size_t(ms * bar_ms_px), 5 * scale, pack_colour(80, 220, 80));
+    }
+}
+
+
+bool Profiler::write_trace(const std::string& filename) const
+{
+    std::ofstream ofs(filename);
+    const uint64_t count = m_event_count.load(std::memory_order_acquire);
+    const uint64_t first = (count > max_events) ? count - max_events : 0;
+
+    ofs << std::fixed << std::setprecision(3) << "{\"traceEvents\":[\n";
+    for (uint64_t e = first; e < count; e++)
+    {
+        const TraceEvent& event = m_events[e % max_events];
+        ofs << (e == first ? "" : ",\n")
+            << "{\"name\":\"" << zone_name(event.zone) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.thread
+            << ",\"ts\":" << event.start_ns / 1000. << ",\"dur\":" << (event.end_ns - event.start_ns) / 1000. << "}";
+    }
+    ofs << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+    if (!ofs)
+    {
+        std::cerr << "Error: cannot write trace " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
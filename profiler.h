@@ -0,0 +1,108 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <atomic>
+#include <mutex>
+
+#include "framebuffer.h"
+
+
+// Collects the time spent in named zones of the frame. PROFILE_SCOPE("name") times the rest of
+// the enclosing scope; building with -DNO_PROFILER (make PROFILE=0) compiles the timers out.
+// Timing only happens while the profiler is enabled, so a disabled timer costs one branch.
+//
+// Per frame totals of the last frame_history frames are kept for the overlay, and every timed
+// scope goes into a ring of the last max_events events for the Chrome trace export.
+class Profiler
+{
+public:
+    static constexpr size_t max_zones = 32;
+    static constexpr size_t frame_history = 120;
+    static constexpr size_t max_events = size_t(1) << 16;
+
+    static Profiler& instance();
+
+    // Id of the zone called name (a string literal), registered on first use
+    size_t zone(const char* name);
+
+    void set_enabled(const bool enabled);
+    bool enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+    uint64_t now_ns() const;
+    void record(const size_t zone, const uint64_t start_ns, const uint64_t end_ns);
+
+    // Close the frame: the zone totals since the previous call become one history entry
+    void end_frame();
+
+    size_t zone_count() const;
+    const char* zone_name(const size_t zone) const;
+    double zone_ms(const size_t zone) const;  // Mean per frame over the history
+
+    // Zone names, mean milliseconds and bars (1 ms = bar_ms_px pixels) from (x, y) down
+    void draw_overlay(FrameBuffer& frame_buf, const size_t x, const size_t y, const size_t bar_ms_px = 40) const;
+
+    // The events still in the ring, as Chrome trace-event JSON (chrome://tracing, Perfetto)
+    bool write_trace(const std::string& filename) const;
+
+private:
+    struct TraceEvent
+    {
+        uint32_t zone;
+        uint32_t thread;
+        uint64_t start_ns;
+        uint64_t end_ns;
+    };
+
+    std::atomic<bool> m_enabled;
+    std::mutex m_zone_mtx;
+    std::atomic<size_t> m_zone_count;
+    const char* m_zone_names[max_zones];
+
+    std::atomic<uint64_t> m_current[max_zones];                  // Frame in progress, ns
+    std::atomic<uint64_t> m_history[frame_history][max_zones];   // Finished frames, ns
+    std::atomic<uint64_t> m_frames;
+
+    TraceEvent m_events[max_events];
+    std::atomic<uint64_t> m_event_count;
+
+    Profiler();
+};
+
+
+class ScopedTimer
+{
+    size_t m_zone;
+    uint64_t m_start;
+
+public:
+    explicit ScopedTimer(const size_t zone)
+        : m_zone(zone), m_start(Profiler::instance().enabled() ? Profiler::instance().now_ns() : 0)
+    {
+    }
+
+    ~ScopedTimer()
+    {
+        if (m_start) Profiler::instance().record(m_zone, m_start, Profiler::instance().now_ns());
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+};
+
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#ifndef NO_PROFILER
+#define PROFILE_SCOPE(name) \
+    static const size_t PROFILE_CONCAT(profile_zone_, __LINE__) = Profiler::instance().zone(name); \
+    ScopedTimer PROFILE_CONCAT(profile_timer_, __LINE__)(PROFILE_CONCAT(profile_zone_, __LINE__))
+#else
+#define PROFILE_SCOPE(name) do {} while (0)
+#endif
+
+
+#endif
@@ -4,8 +4,12 @@
 #include <vector>
 #include <cstdint>
 #include <cassert>
+#include <algorithm>
+#include <cstring>
 #include <sstream>
 #include <iomanip>
+#include <chrono>
+#include <bit>
 #include "SDL.h"
 
 #include "map.h"
@@ -15,30 +19,7 @@
 #include "textures.h"
 #include "sprite.h"
 #include "render.h"
-
-
-bool update_player_state(GameState& game_state)
-{
-    SDL_Event event;
-    if (SDL_PollEvent(&event))
-    {
-        if (SDL_QUIT == event.type || (SDL_KEYDOWN==event.type && SDLK_ESCAPE==event.key.keysym.sym)) return false;
-        if (SDL_KEYUP == event.type)
-        {
-            if ('a' == event.key.keysym.sym || 'd'==event.key.keysym.sym) game_state.player.turn = 0;
-            if ('w' == event.key.keysym.sym || 's'==event.key.keysym.sym) game_state.player.walk = 0;
-        }
-        if (SDL_KEYDOWN==event.type)
-        {
-            if ('a' == event.key.keysym.sym) game_state.player.turn = -1;
-            if ('d' == event.key.keysym.sym) game_state.player.turn =  1;
-            if ('w' == event.key.keysym.sym) game_state.player.walk =  1;
-            if ('s' == event.key.keysym.sym) game_state.player.walk = -1;
-        }
-    }
-
-    return true;
-}
+#include "profiler.h"
 
 
 void update_player_position(GameState& game_state)
@@ -52,17 +33,151 @@ void update_player_position(GameState& game_state)
         if (game_state.map.is_empty(new_x, game_state.player.y_pos)) game_state.player.x_pos = new_x;
         if (game_state.map.is_empty(game_state.player.x_pos, new_y)) game_state.player.y_pos = new_y;
     }
+}
+
+
+// Result of casting one ray through the map
+struct RayHit
+{
+    bool hit;         // False if the ray left the map or exceeded the maximum ray distance
+    double dist;      // Euclidean distance along the ray to the hit point
+    double x;         // Hit point in map coordinates
+    double y;
+    size_t cell_i;    // Wall cell that was hit
+    size_t cell_j;
+    double wall_x;    // Exact fractional position of the hit along the wall face, in [0,1)
+};
+
+
+static const double min_wall_dist = 0.01;  // Near plane: bounds the wall column height when hugging a wall
+
 
-    // Update distances from the player to each sprite
-    for (size_t i = 0; i < game_state.monsters.size(); i++)
+// Legacy ray marcher: steps 0.01 along the unit direction (dir_x, dir_y) until it enters a wall
+// cell, missing once it leaves the map
+RayHit cast_ray_march(const Map& map, const Player& player, const double dir_x, const double dir_y,
+                      const double max_ray_dist)
+{
+    for (double t = 0; t < max_ray_dist; t += 0.01)
     {
-        game_state.monsters[i].player_dist = std::sqrt(pow(game_state.player.x_pos - game_state.monsters[i].x_pos, 2) +
-                                                        pow(game_state.player.y_pos - game_state.monsters[i].y_pos, 2));
+        double x = player.x_pos + t*dir_x;
+        double y = player.y_pos + t*dir_y;
+
+        if (x < 0 || y < 0 || x >= map.width() || y >= map.height()) break;
+        if (map.is_empty(x, y)) continue;
+
+        return RayHit{true, t, x, y, size_t(x), size_t(y), 0.};
     }
-    std::sort(game_state.monsters.begin(), game_state.monsters.end());
+
+    return RayHit{false, max_ray_dist, 0., 0., 0, 0, 0.};
 }
 
 
+// DDA traversal: visit exactly the grid cells crossed by the ray, in order, and stop at the
+// first wall. The hit distance and the wall face are exact rather than quantised by a step size.
+// With skip_empty and a map distance field, the ray jumps across the empty square around its
+// current cell in one step instead of visiting every cell of it. A camera outside the map sees nothing.
+RayHit cast_ray_dda(const Map& map, const Player& player, const double dir_x, const double dir_y,
+                    const double max_ray_dist, const bool skip_empty)
+{
+    if (player.x_pos < 0 || player.y_pos < 0 || player.x_pos >= map.width() || player.y_pos >= map.height())
+        return RayHit{false, max_ray_dist, 0., 0., 0, 0, 0.};
+
+    int cell_i = int(player.x_pos);
+    int cell_j = int(player.y_pos);
+
+    // Ray length needed to cross one whole cell along each axis
+    const double delta_x = (dir_x == 0) ? 1e30 : std::abs(1./dir_x);
+    const double delta_y = (dir_y == 0) ? 1e30 : std::abs(1./dir_y);
+
+    // Ray length to the first vertical (x) and horizontal (y) grid line
+    const int step_i = (dir_x < 0) ? -1 : 1;
+    const int step_j = (dir_y < 0) ? -1 : 1;
+    double side_x = (dir_x < 0) ? (player.x_pos - cell_i)*delta_x : (cell_i + 1. - player.x_pos)*delta_x;
+    double side_y = (dir_y < 0) ? (player.y_pos - cell_j)*delta_y : (cell_j + 1. - player.y_pos)*delta_y;
+
+    const bool use_field = skip_empty && map.has_distance_field();
+
+    while (true)
+    {
+        double t;
+        bool vertical_wall;
+
+        const int radius = use_field ? map.empty_radius(cell_i, cell_j) - 1 : 0;
+        if (radius > 1)
+        {
+            // Cells up to radius away are empty: leave that square in one jump, stopping just
+            // short of its edge so the ray lands in a known empty cell
+            double exit_x = (dir_x < 0) ? (player.x_pos - (cell_i - radius))*delta_x : (cell_i + radius + 1. - player.x_pos)*delta_x;
+            double exit_y = (dir_y < 0) ? (player.y_pos - (cell_j - radius))*delta_y : (cell_j + radius + 1. - player.y_pos)*delta_y;
+            double jump = std::min(exit_x, exit_y) - 1e-6;
+
+            if (jump >= max_ray_dist) break;
+            if (jump > std::min(side_x, side_y))
+            {
+                cell_i = int(player.x_pos + jump*dir_x);
+                cell_j = int(player.y_pos + jump*dir_y);
+                side_x = (dir_x < 0) ? (player.x_pos - cell_i)*delta_x : (cell_i + 1. - player.x_pos)*delta_x;
+                side_y = (dir_y < 0) ? (player.y_pos - cell_j)*delta_y : (cell_j + 1. - player.y_pos)*delta_y;
+            }
+        }
+
+        if (side_x < side_y)
+        {
+            t = side_x;
+            side_x += delta_x;
+            cell_i += step_i;
+            vertical_wall = true;
+        }
+        else
+        {
+            t = side_y;
+            side_y += delta_y;
+            cell_j += step_j;
+            vertical_wall = false;
+        }
+
+        if (t >= max_ray_dist) break;
+        if (cell_i < 0 || cell_j < 0 || cell_i >= int(map.width()) || cell_j >= int(map.height())) break;
+        if (map.is_empty(cell_i, cell_j)) continue;
+
+        double x = player.x_pos + t*dir_x;
+        double y = player.y_pos + t*dir_y;
+        double wall_x = vertical_wall ? y - floor(y) : x - floor(x);
+
+        return RayHit{true, t, x, y, size_t(cell_i), size_t(cell_j), wall_x};
+    }
+
+    return RayHit{false, max_ray_dist, 0., 0., 0, 0, 0.};
+}
+
+
+// Draw the ray on the map as a line from the player to its hit point, or to where it leaves the map
+void draw_ray_line(FrameBuffer& frame_buf, const Map& map, const Player& player, const double dir_x, const double dir_y,
+                   double dist, const size_t cell_w, const size_t cell_h)
+{
+    if (dir_x != 0) dist = std::min(dist, ((dir_x > 0) ? map.width() - player.x_pos : player.x_pos) / std::abs(dir_x));
+    if (dir_y != 0) dist = std::min(dist, ((dir_y > 0) ? map.height() - player.y_pos : player.y_pos) / std::abs(dir_y));
+
+    const long map_w = long(map.width() * cell_w);
+    const long map_h = long(map.height() * cell_h);
+    const long x0 = std::clamp(long(player.x_pos * cell_w), 0L, map_w - 1);
+    const long y0 = std::clamp(long(player.y_pos * cell_h), 0L, map_h - 1);
+    const long x1 = std::clamp(long((player.x_pos + dist*dir_x) * cell_w), 0L, map_w - 1);
+    const long y1 = std::clamp(long((player.y_pos + dist*dir_y) * cell_h), 0L, map_h - 1);
+    frame_buf.draw_line(x0, y0, x1, y1, pack_colour(190, 190, 190));
+}
+
+
+// Texture column from the exact fractional hit position along the wall
+int wall_x_coord(const double wall_x, const Texture& texture_walls)
+{
+    int texture = wall_x * texture_walls.texture_size();
+    texture = std::clamp(texture, 0, int(texture_walls.texture_size()) - 1);
+    return texture;
+}
+
+
+// Texture column estimated from a hit point near a grid line (for the legacy ray marcher)
 int wall_x_coord(const double x, const double y, const Texture& texture_walls)
 {
     double hit_x = x - floor(x + 0.5);
@@ -80,9 +195,9 @@ int wall_x_coord(const double x, const double y, const Texture& texture_walls)
 }
 
 
-void draw_map(FrameBuffer& fb, const std::vector<Sprite> &sprites,
-              const Texture &tex_walls, const Map &map,
-              const size_t cell_w, const size_t cell_h)
+// The static part of the map: one rectangle per wall cell
+void draw_map_walls(FrameBuffer& fb, const Texture &tex_walls, const Map &map,
+                    const size_t cell_w, const size_t cell_h)
 {
     for (size_t j = 0; j < map.height(); j++)
     {
@@ -98,18 +213,58 @@ void draw_map(FrameBuffer& fb, const std::vector<Sprite> &sprites,
             fb.draw_rectangle(rect_x, rect_y, cell_w, cell_h, tex_walls.get_px_from_texture(0, 0, texture_id)); // Colour taken from  upper left pixel of texture #texture_id
         }
     }
+}
+
+
+// A marker square per sprite. Squares lying wholly in the buffer are filled directly, and only
+// the others go through draw_rectangle's clipping.
+void draw_map_sprites(FrameBuffer& fb, const std::vector<Sprite> &sprites, const size_t cell_w, const size_t cell_h)
+{
+    if (!fb.width() || !fb.height()) return;
+
+    const size_t marker = 6;
+    const uint32_t colour = pack_colour(255, 0, 0);
+    const size_t width = fb.width();
+    const size_t height = fb.height();
+    const size_t pitch = fb.pitch();
+    uint32_t* pixels = fb.pixel_ptr(0, 0);
 
     for (size_t i = 0; i < sprites.size(); i++)
     {
-        fb.draw_rectangle(sprites[i].x_pos * cell_w-3, sprites[i].y_pos*cell_h-3, 6, 6, pack_colour(255, 0, 0));
+        const double x = sprites[i].x_pos * cell_w - marker/2;
+        const double y = sprites[i].y_pos * cell_h - marker/2;
+        if (x >= 0 && y >= 0 && size_t(x) + marker <= width && size_t(y) + marker <= height)
+        {
+            uint32_t* row = pixels + size_t(x) + size_t(y)*pitch;
+            for (size_t j = 0; j < marker; j++, row += pitch)
+                for (size_t k = 0; k < marker; k++)
+                    row[k] = colour;
+            continue;
+        }
+        fb.draw_rectangle(x, y, marker, marker, colour);
     }
 }
 
 
-void draw_sprite(FrameBuffer& fb, const Sprite& sprite, const std::vector<double>& depth_buffer, const Player& player, const Texture& tex_sprites)
+// Draw the part of a sprite falling in 3D view columns [col_begin, col_end)
+// False if the sprite covers no column of the view_w wide 3D view
+bool project_sprite(const Sprite& sprite, const Player& player, const double dir_cos, const double dir_sin,
+                    const size_t view_w, const size_t view_h, const size_t texture_size, SpriteProjection& proj)
 {
-    double sprite_direction = atan2(sprite.y_pos - player.y_pos, sprite.x_pos - player.x_pos);
-    
+    const double dx = sprite.x_pos - player.x_pos;
+    const double dy = sprite.y_pos - player.y_pos;
+
+    const double dist_sq = dx*dx + dy*dy;  // From the camera, which may sit between two ticks
+
+    // Cheap rejection first: farther than one cell, a sprite is at most half the view wide, so it
+    // cannot reach the screen from behind the player
+    if (dx*dir_cos + dy*dir_sin < 0 && dist_sq > 1) return false;
+
+    proj.dist = std::sqrt(dist_sq);
+    if (proj.dist < min_wall_dist) return false;
+
+    double sprite_direction = atan2(dy, dx);
+
     while (sprite_direction - player.direction >  M_PI)
     {
         sprite_direction -= 2*M_PI;
@@ -119,91 +274,701 @@ void draw_sprite(FrameBuffer& fb, const Sprite& sprite, const std::vector<double
         sprite_direction += 2*M_PI;
     }
 
-    size_t sprite_screen_size = std::min(1000, static_cast<int>(fb.height()/sprite.player_dist));
-    int h_offset = (sprite_direction - player.direction) / player.fov * (fb.width()/2)
-                 + (fb.width()/2)/2 - tex_sprites.texture_size()/2;
-    int v_offset = fb.height()/2 - sprite_screen_size/2;
+    proj.size = std::min(1000, static_cast<int>(view_h/proj.dist));
+    if (!proj.size) return false;
+
+    proj.h_offset = (sprite_direction - player.direction) / player.fov * view_w
+                  + view_w/2 - texture_size/2;
+    proj.v_offset = view_h/2 - proj.size/2;
+
+    return proj.h_offset < int(view_w) && proj.h_offset + int(proj.size) > 0;
+}
+
+
+// Texture::mip_level, computed from the constant size for a texture of 1 << size_shift texels:
+// the last level at least out_size texels tall
+template <unsigned size_shift>
+static size_t mip_level_for(const Texture& texture, const size_t out_size)
+{
+    if (!size_shift) return texture.mip_level(out_size);
+
+    const unsigned needed = out_size ? unsigned(std::bit_width(out_size - 1)) : 0;  // log2 of out_size, rounded up
+    if (needed >= size_shift) return 0;
+    return std::min<size_t>(texture.mip_levels() - 1, size_shift - needed);
+}
+
+
+// Shaded copy of texture to draw something dist away with, the copies spreading evenly over
+// [0, fog_dist). Always 0 when fog_dist is 0 or the texture has no shaded copies.
+size_t shade_for(const double dist, const double fog_dist, const Texture& texture)
+{
+    const size_t shade_levels = texture.shade_levels();
+    if (shade_levels <= 1 || fog_dist <= 0) return 0;
+    return std::min(shade_levels - 1, size_t(dist / fog_dist * shade_levels));
+}
+
+
+// Sprite kernel: without lighting nothing is shaded, and with size_shift not 0 the texture is
+// 1 << size_shift texels wide
+template <unsigned size_shift, bool lighting>
+static void draw_sprite(FrameBuffer& fb, const SpriteProjection& proj, const size_t texture_id, const std::vector<double>& depth_buffer,
+                        const Texture& tex_sprites, const size_t col_begin, const size_t col_end, const double fog_dist)
+{
+    const int h_offset = proj.h_offset;
+    const int v_offset = proj.v_offset;
+    const size_t sprite_screen_size = proj.size;
+
+    // Clip the sprite square once: columns to [col_begin, col_end), rows to the view
+    size_t i_begin = std::max(0, int(col_begin) - h_offset);
+    size_t i_end   = std::max(0, std::min(int(sprite_screen_size), int(col_end) - h_offset));
+    size_t j_begin = std::max(0, -v_offset);
+    size_t j_end   = std::max(0, std::min(int(sprite_screen_size), int(fb.height()) - v_offset));
+    if (j_begin >= j_end) return;
+
+    const size_t level = mip_level_for<size_shift>(tex_sprites, sprite_screen_size);
+    const size_t shade = lighting ? shade_for(proj.dist, fog_dist, tex_sprites) : 0;
+
+    if constexpr (!size_shift)
+    {
+        for (size_t i = i_begin; i < i_end; i++)
+        {
+            if (depth_buffer[h_offset+i] < proj.dist) continue;
+
+            tex_sprites.copy_scaled_column(texture_id, i * tex_sprites.texture_size() / sprite_screen_size,
+                                           sprite_screen_size, j_begin, j_end,
+                                           fb.pixel_ptr(h_offset+i, v_offset+j_begin), fb.pitch(), true, level, shade);
+        }
+    }
+    else
+    {
+        // Texture column i*size/sprite_screen_size, kept as a quotient and a remainder stepped
+        // along the columns rather than divided for each
+        const size_t size = size_t(1) << size_shift;
+        size_t texture_coord = (i_begin << size_shift) / sprite_screen_size;
+        size_t remainder = (i_begin << size_shift) % sprite_screen_size;
+
+        for (size_t i = i_begin; i < i_end; i++)
+        {
+            if (depth_buffer[h_offset+i] >= proj.dist)
+                tex_sprites.copy_scaled_column<size_shift, true>(texture_id, texture_coord, sprite_screen_size, j_begin, j_end,
+                                                                 fb.pixel_ptr(h_offset+i, v_offset+j_begin), fb.pitch(),
+                                                                 level, shade);
+
+            remainder += size;
+            while (remainder >= sprite_screen_size)
+            {
+                remainder -= sprite_screen_size;
+                texture_coord++;
+            }
+        }
+    }
+}
+
+
+Renderer::Renderer(const RenderSettings& settings)
+    : m_settings(settings), m_pool(settings.thread_count), m_depth_buffer(), m_ray_dist(), m_wall_top(),
+      m_wall_bottom(), m_column_rays(), m_column_rays_fov(0), m_sprite_grid(), m_sprite_candidates(), m_visible_sprites(), m_unsorted_sprites(),
+      m_sprite_order(), m_sprite_slot(), m_sprites(),
+      m_minimap(0, 0, 0), m_minimap_map(nullptr), m_minimap_cell_w(0), m_minimap_cell_h(0), m_view_pixels(),
+      m_upscale_cols(), m_render_scale(1), m_frame_ms(0), m_floor_ms(0),
+      m_kernels{0, 0, false, false, false, &Renderer::draw_walls<0, true>, draw_sprite<0, true>}
+{
+}
+
+
+RenderSettings& Renderer::settings() { return m_settings; }
+size_t Renderer::thread_count() const { return m_pool.thread_count(); }
+double Renderer::render_scale() const { return m_render_scale; }
+double Renderer::floor_ms() const { return m_floor_ms; }
+bool Renderer::specialized() const { return m_kernels.specialized; }
+
+
+void Renderer::adapt_render_scale(const double frame_ms)
+{
+    const double min_scale = std::clamp(m_settings.min_scale, 0.05, 1.);
+
+    // Smooth out single slow frames, then aim for the target assuming the cost goes with the pixel count.
+    // Small corrections are skipped so the view does not flicker between neighbouring sizes.
+    m_frame_ms = m_frame_ms ? 0.8*m_frame_ms + 0.2*frame_ms : frame_ms;
+    const double scale = std::clamp(m_render_scale * std::sqrt(m_settings.target_ms / m_frame_ms), min_scale, 1.);
+    if (std::abs(scale - m_render_scale) < 0.03) return;
+
+    m_frame_ms *= (scale * scale) / (m_render_scale * m_render_scale);
+    m_render_scale = scale;
+}
+
+
+// Rows of the view buffer: whole cache lines, but never a multiple of 1 KiB. Walls are drawn
+// column by column, and with a power of two pitch consecutive rows of a column map to the same
+// cache sets and evict each other (a 4 KiB pitch made the walls several times slower).
+static size_t view_pitch_for(const size_t width)
+{
+    size_t pitch = (width + 15) / 16 * 16;
+    if (pitch % 256 == 0) pitch += 16;
+    return pitch;
+}
+
+
+void Renderer::upscale_view(const FrameBuffer& view_buf, FrameBuffer& frame_buf, const size_t out_x)
+{
+    const size_t out_w = frame_buf.width() - out_x;
+    const size_t out_h = frame_buf.height();
+
+    m_upscale_cols.resize(out_w);
+    for (size_t i = 0; i < out_w; i++)
+        m_upscale_cols[i] = uint32_t(i * view_buf.width() / out_w);
+    const bool same_width = view_buf.width() == out_w;
+
+    // Nearest neighbour. Output rows sampling the same view row as the row above are copies of it.
+    m_pool.parallel_for(out_h, 16, [&](size_t row_begin, size_t row_end)
+    {
+        for (size_t j = row_begin; j < row_end; j++)
+        {
+            const size_t src_j = j * view_buf.height() / out_h;
+            uint32_t* dst = frame_buf.pixel_ptr(out_x, j);
+            if (same_width)
+            {
+                std::memcpy(dst, view_buf.pixel_ptr(0, src_j), out_w * sizeof(uint32_t));
+                continue;
+            }
+            if (j > row_begin && src_j == (j - 1) * view_buf.height() / out_h)
+            {
+                std::memcpy(dst, frame_buf.pixel_ptr(out_x, j - 1), out_w * sizeof(uint32_t));
+                continue;
+            }
+
+            const uint32_t* src = view_buf.pixel_ptr(0, src_j);
+            for (size_t i = 0; i < out_w; i++)
+                dst[i] = src[m_upscale_cols[i]];
+        }
+    });
+}
+
+
+// Wall kernel: columns [col_begin, col_end) of the 3D view. Without lighting nothing is shaded, and
+// with size_shift not 0 the wall textures are 1 << size_shift texels wide.
+template <unsigned size_shift, bool lighting>
+void Renderer::draw_walls(FrameBuffer& view_buf, const GameState& game_state, const Player& player, const double dir_cos,
+                          const double dir_sin, const size_t col_begin, const size_t col_end)
+{
+    const Map& map = game_state.map;
+    const Texture& texture_walls = game_state.texture_walls;
+    const size_t view_h = view_buf.height();
+    const double fog_dist = m_settings.lighting ? m_settings.fog_dist : 0;
+
+    for (size_t i = col_begin; i < col_end; i++)
+    {
+        const ColumnRay& column = m_column_rays[i];
+        const double dir_x = dir_cos*column.cos_offset - dir_sin*column.sin_offset;
+        const double dir_y = dir_sin*column.cos_offset + dir_cos*column.sin_offset;
+
+        RayHit ray;
+        int texture_x;
+        if (m_settings.ray_caster == RayCaster::dda)
+        {
+            ray = cast_ray_dda(map, player, dir_x, dir_y, m_settings.max_ray_dist, m_settings.skip_empty);
+            texture_x = size_shift ? std::min(int(ray.wall_x * (1 << size_shift)), (1 << size_shift) - 1)
+                                   : wall_x_coord(ray.wall_x, texture_walls);
+        }
+        else
+        {
+            ray = cast_ray_march(map, player, dir_x, dir_y, m_settings.max_ray_dist);
+            texture_x = wall_x_coord(ray.x, ray.y, texture_walls);
+        }
+
+        m_ray_dist[i] = ray.dist;
+        m_wall_top[i] = m_wall_bottom[i] = int32_t(view_h/2);
+        if (!ray.hit) continue;
+
+        // Ray touches a wall, so draw the vertical column to create illusion of 3D
+        size_t texture_id = map.get(ray.cell_i, ray.cell_j);
+        assert(texture_id < texture_walls.texture_count());
+
+        double dist = std::max(ray.dist * column.cos_offset, min_wall_dist);
+        m_depth_buffer[i] = dist;
+
+        size_t column_height = view_h/dist;
+
+        // Scale the texture column straight into the view, only over its visible rows
+        long top = long(view_h/2) - long(column_height/2);
+        size_t row_begin = std::max(0L, -top);
+        size_t row_end = std::min(long(column_height), long(view_h) - top);
+        if (row_begin >= row_end) continue;
+        m_wall_top[i] = int32_t(top + row_begin);
+        m_wall_bottom[i] = int32_t(top + row_end);
+
+        const size_t level = mip_level_for<size_shift>(texture_walls, column_height);
+        const size_t shade = lighting ? shade_for(dist, fog_dist, texture_walls) : 0;
+        uint32_t* dst = view_buf.pixel_ptr(i, top + row_begin);
+        if constexpr (size_shift)
+            texture_walls.copy_scaled_column<size_shift, false>(texture_id, texture_x, column_height, row_begin, row_end,
+                                                                dst, view_buf.pitch(), level, shade);
+        else
+            texture_walls.copy_scaled_column(texture_id, texture_x, column_height, row_begin, row_end,
+                                             dst, view_buf.pitch(), false, level, shade);
+    }
+}
+
+
+// log2 of a texture size there are kernels for, 0 for the others
+static unsigned specialized_shift(const size_t texture_size)
+{
+#ifdef NO_SPECIALIZED_KERNELS
+    (void)texture_size;
+    return 0;
+#else
+    if (!std::has_single_bit(texture_size) || texture_size < 32 || texture_size > 256) return 0;
+    return unsigned(std::countr_zero(texture_size));
+#endif
+}
+
+
+void Renderer::select_kernels(const Texture& texture_walls, const Texture& texture_monster)
+{
+    const bool lighting = m_settings.lighting && m_settings.fog_dist > 0;
+    if (texture_walls.texture_size() == m_kernels.wall_size
+        && texture_monster.texture_size() == m_kernels.sprite_size && m_settings.specialize == m_kernels.specialize
+        && lighting == m_kernels.lighting) return;
+
+    m_kernels.wall_size = texture_walls.texture_size();
+    m_kernels.sprite_size = texture_monster.texture_size();
+    m_kernels.specialize = m_settings.specialize;
+    m_kernels.lighting = lighting;
+
+    // The generic kernels read the sizes from the textures and shade whenever fog_dist is not 0
+    m_kernels.walls = &Renderer::draw_walls<0, true>;
+    m_kernels.sprite = draw_sprite<0, true>;
+    m_kernels.specialized = false;
+    if (!m_settings.specialize) return;
+
+#ifndef NO_SPECIALIZED_KERNELS
+    // Indexed by size_shift - 5, then lighting
+    static const WallKernel wall_kernels[4][2] = {
+        {&Renderer::draw_walls<5, false>, &Renderer::draw_walls<5, true>},
+        {&Renderer::draw_walls<6, false>, &Renderer::draw_walls<6, true>},
+        {&Renderer::draw_walls<7, false>, &Renderer::draw_walls<7, true>},
+        {&Renderer::draw_walls<8, false>, &Renderer::draw_walls<8, true>}};
+    static const SpriteKernel sprite_kernels[4][2] = {
+        {draw_sprite<5, false>, draw_sprite<5, true>},
+        {draw_sprite<6, false>, draw_sprite<6, true>},
+        {draw_sprite<7, false>, draw_sprite<7, true>},
+        {draw_sprite<8, false>, draw_sprite<8, true>}};
+
+    // Walls and sprites each use their own kernels when there are some for their size
+    const unsigned wall_shift = specialized_shift(m_kernels.wall_size);
+    const unsigned sprite_shift = specialized_shift(m_kernels.sprite_size);
+    if (wall_shift) m_kernels.walls = wall_kernels[wall_shift - 5][lighting];
+    if (sprite_shift) m_kernels.sprite = sprite_kernels[sprite_shift - 5][lighting];
+    m_kernels.specialized = wall_shift && sprite_shift;
+#endif
+}
+
+
+void Renderer::update_column_rays(const double fov, const size_t view_w)
+{
+    if (fov == m_column_rays_fov && view_w == m_column_rays.size()) return;
+
+    // Same angular spacing as before the table: column i looks fov*i/view_w past the left edge
+    m_column_rays.resize(view_w);
+    for (size_t i = 0; i < view_w; i++)
+    {
+        const double offset = -fov/2 + fov*i/double(view_w);
+        m_column_rays[i] = ColumnRay{cos(offset), sin(offset), tan(offset)};
+    }
+    m_column_rays_fov = fov;
+}
+
+
+// Floors and ceilings are drawn row by row rather than column by column: along a view row the
+// floor is at one distance, so each row costs one setup and then walks the view buffer and the
+// map cells in order. A floor row and the ceiling row mirroring it across the horizon share their
+// floor points, and only the pixels the walls left uncovered are textured.
+void Renderer::draw_floors(FrameBuffer& view_buf, const Map& map, const Texture& texture_walls, const Player& player,
+                           const double dir_cos, const double dir_sin)
+{
+    const size_t view_w = view_buf.width();
+    const size_t view_h = view_buf.height();
+    const double map_w = double(map.width());
+    const double map_h = double(map.height());
+    const size_t first_row = view_h/2;  // Floor row k is first_row + k, its ceiling row view_h - 1 - first_row - k
+    const double fog_dist = m_settings.lighting ? m_settings.fog_dist : 0;
+
+    m_pool.parallel_for(view_h - first_row, m_settings.floor_grain, [&](size_t row_begin, size_t row_end)
+    {
+        for (size_t k = row_begin; k < row_end; k++)
+        {
+            const size_t floor_row = first_row + k;
+            const size_t ceiling_row = view_h - 1 - floor_row;
+            const double p = floor_row + 0.5 - view_h/2.;
+            if (p <= 0) continue;  // The horizon row of an odd height view
+
+            // Distance along the view direction to the floor under this row: a wall that far
+            // away ends on this row. Column i sees the floor at base + tan_offset[i] * side.
+            const double row_dist = view_h / (2*p);
+            const double base_x = player.x_pos + row_dist*dir_cos;
+            const double base_y = player.y_pos + row_dist*dir_sin;
+            const double side_x = -row_dist*dir_sin;
+            const double side_y =  row_dist*dir_cos;
+
+            // A cell is about view_w / (row_dist * fov) pixels across at this distance
+            const Texture::TexelView tv = texture_walls.texel_view(
+                texture_walls.mip_level(size_t(view_w / (row_dist * player.fov))), shade_for(row_dist, fog_dist, texture_walls));
+            const double texel_scale = double(tv.size);
+
+            uint32_t* floor_px = view_buf.pixel_ptr(0, floor_row);
+            uint32_t* ceiling_px = view_buf.pixel_ptr(0, ceiling_row);
+
+            for (size_t i = 0; i < view_w; i++)
+            {
+                const bool floor_visible = int32_t(floor_row) >= m_wall_bottom[i];
+                const bool ceiling_visible = int32_t(ceiling_row) < m_wall_top[i];
+                if (!floor_visible && !ceiling_visible) continue;
+
+                const double x = base_x + m_column_rays[i].tan_offset*side_x;
+                const double y = base_y + m_column_rays[i].tan_offset*side_y;
+                if (x < 0 || y < 0 || x >= map_w || y >= map_h) continue;
+
+                const size_t cell_i = size_t(x);
+                const size_t cell_j = size_t(y);
+                const size_t u = std::min(size_t((x - cell_i) * texel_scale), tv.size - 1);
+                const size_t v = std::min(size_t((y - cell_j) * texel_scale), tv.size - 1);
+                const uint32_t* texel = tv.texels + u*tv.stride_i + v*tv.stride_j;
+
+                if (floor_visible)
+                {
+                    const uint8_t id = map.floor_texture(cell_i, cell_j);
+                    assert(id == Map::empty_cell || id < texture_walls.texture_count());
+                    if (id != Map::empty_cell) floor_px[i] = texel[id*tv.texture_stride];
+                }
+                if (ceiling_visible)
+                {
+                    const uint8_t id = map.ceiling_texture(cell_i, cell_j);
+                    assert(id == Map::empty_cell || id < texture_walls.texture_count());
+                    if (id != Map::empty_cell) ceiling_px[i] = texel[id*tv.texture_stride];
+                }
+            }
+        }
+    });
+}
+
+
+void Renderer::update_minimap(const Map& map, const Texture& texture_walls, const size_t cell_w, const size_t cell_h)
+{
+    if (&map == m_minimap_map && cell_w == m_minimap_cell_w && cell_h == m_minimap_cell_h
+        && m_minimap.width() == map.width() * cell_w && m_minimap.height() == map.height() * cell_h) return;
+
+    m_minimap = FrameBuffer(map.width() * cell_w, map.height() * cell_h, pack_colour(255, 255, 255));
+    draw_map_walls(m_minimap, texture_walls, map, cell_w, cell_h);
+    m_minimap_map = &map;
+    m_minimap_cell_w = cell_w;
+    m_minimap_cell_h = cell_h;
+}
+
+
+// A pixel of a sprite shows where its column's ray gets past the sprite's distance, so one of the
+// cells at that distance along the rays of its columns must be visible from the camera's cell.
+// Those points lie on an arc about a cell long, bounded by its ends and middle. Sprites are kept
+// close up, where the arc bends most, and past max_dist: beyond the range of the sets, or of the
+// rays, which see no wall there.
+static bool sprite_may_be_visible(const Visibility& visibility, const Map& map, const Player& player,
+                                  const SpriteProjection& proj, const size_t view_w, const double max_dist)
+{
+    if (proj.dist < 2 || proj.dist > max_dist) return true;
+
+    const int first = std::max(0, proj.h_offset);
+    const int last = std::min(int(view_w), proj.h_offset + int(proj.size)) - 1;
+    double x0 = map.width(), x1 = 0, y0 = map.height(), y1 = 0;
+    for (const int column : {first, (first + last) / 2, last})
+    {
+        const double angle = player.direction - player.fov/2 + player.fov*column/double(view_w);
+        const double x = player.x_pos + proj.dist*cos(angle);
+        const double y = player.y_pos + proj.dist*sin(angle);
+        x0 = std::min(x0, x); x1 = std::max(x1, x);
+        y0 = std::min(y0, y); y1 = std::max(y1, y);
+    }
+
+    const double margin = 0.05;  // Covers the bulge of the arc between the points
+    const size_t i0 = size_t(std::clamp(x0 - margin, 0., map.width() - 1.));
+    const size_t i1 = size_t(std::clamp(x1 + margin, 0., map.width() - 1.));
+    const size_t j0 = size_t(std::clamp(y0 - margin, 0., map.height() - 1.));
+    const size_t j1 = size_t(std::clamp(y1 + margin, 0., map.height() - 1.));
+    const size_t camera_i = size_t(player.x_pos);
+    const size_t camera_j = size_t(player.y_pos);
+
+    for (size_t j = j0; j <= j1; j++)
+        for (size_t i = i0; i <= i1; i++)
+            if (visibility.visible(camera_i, camera_j, i, j)) return true;
+    return false;
+}
+
+
+static const uint32_t no_slot = 0xffffffff;  // Renderer::m_sprite_slot of a sprite not projected this frame
+
+
+// Far to near from the camera, ties kept in index order
+static bool farther(const SpriteProjection& a, const SpriteProjection& b)
+{
+    return a.dist > b.dist || (a.dist == b.dist && a.index < b.index);
+}
+
+
+// Sort sprites far to near. On the previous frame's order this is an insertion sort costing O(n);
+// it falls back to std::sort when too much has changed.
+static void sort_sprites(std::vector<SpriteProjection>& sprites)
+{
+    // Give up on insertion once it has shifted more than a few elements per sprite
+    const size_t move_budget = 8 * sprites.size() + 64;
+    size_t moves = 0;
+
+    for (size_t i = 1; i < sprites.size(); i++)
+    {
+        if (!farther(sprites[i], sprites[i-1])) continue;
+
+        SpriteProjection sprite = sprites[i];
+        size_t k = i;
+        for (; k > 0 && farther(sprite, sprites[k-1]); k--)
+            sprites[k] = sprites[k-1];
+        sprites[k] = sprite;
+
+        moves += i - k;
+        if (moves > move_budget)
+        {
+            std::sort(sprites.begin(), sprites.end(), farther);
+            return;
+        }
+    }
+}
+
+
+void Renderer::cull_sprites(const GameState& game_state, const Player& player, const double dir_cos, const double dir_sin,
+                            const std::vector<Sprite>& sprites, const size_t view_w, const size_t view_h,
+                            const double range, const Visibility* visibility)
+{
+    m_sprite_candidates.clear();
+    m_unsorted_sprites.clear();
 
-    for (size_t i = 0; i < sprite_screen_size; i++)
+    if (m_settings.cull_sprites)
     {
-        if (h_offset + int(i) < 0 || h_offset + i >= fb.width()/2) continue;
-        if (depth_buffer[h_offset+i] < sprite.player_dist) continue;
-        
-        for (size_t j = 0; j < sprite_screen_size; j++)
+        // Bounding box of the view cone out to range, widened by the angle the largest
+        // sprite more than a cell away can stick out into the view, plus the cell around the player
+        const double half_angle = std::min(M_PI, player.fov/2 + std::min<size_t>(1000, view_h)/2. / view_w * player.fov);
+        double x0 = player.x_pos - 1, x1 = player.x_pos + 1;
+        double y0 = player.y_pos - 1, y1 = player.y_pos + 1;
+
+        auto extend = [&](const double angle)
+        {
+            const double x = player.x_pos + range*cos(angle);
+            const double y = player.y_pos + range*sin(angle);
+            x0 = std::min(x0, x); x1 = std::max(x1, x);
+            y0 = std::min(y0, y); y1 = std::max(y1, y);
+        };
+        extend(player.direction - half_angle);
+        extend(player.direction + half_angle);
+        // The arc bulges furthest where it crosses an axis
+        for (double angle = std::ceil((player.direction - half_angle) / (M_PI/2)) * (M_PI/2);
+             angle < player.direction + half_angle; angle += M_PI/2)
         {
-            if (v_offset + int(j) < 0 || v_offset + j >= fb.height()) continue;
-            
-            uint8_t r, g, b, a;
-            uint32_t colour = tex_sprites.get_px_from_texture(i * tex_sprites.texture_size() / sprite_screen_size,
-                                                              j * tex_sprites.texture_size() / sprite_screen_size, 
-                                                              sprite.texture_id);
-            unpack_colour(colour, r, g, b, a);
-            if (a>128) fb.set_pixel(fb.width()/2 + h_offset+i, v_offset+j, colour);
+            extend(angle);
         }
+
+        m_sprite_grid.build(sprites, game_state.map.width(), game_state.map.height());
+        m_sprite_grid.query(x0, y0, x1, y1, m_sprite_candidates);
+    }
+    else
+    {
+        for (size_t i = 0; i < sprites.size(); i++)
+            m_sprite_candidates.push_back(uint32_t(i));
     }
+
+    SpriteProjection proj;
+    for (uint32_t i : m_sprite_candidates)
+    {
+        if (!project_sprite(sprites[i], player, dir_cos, dir_sin, view_w, view_h,
+                            game_state.texture_monster.texture_size(), proj)) continue;
+        if (visibility && !sprite_may_be_visible(*visibility, game_state.map, player, proj, view_w,
+                                                 std::min(m_settings.max_ray_dist, visibility->max_dist()))) continue;
+        proj.index = i;
+        m_unsorted_sprites.push_back(proj);
+    }
+
+    // Start from the last frame's order: the sprites still visible keep their places, and the
+    // newly visible ones follow in candidate order. Sprites barely move between frames, so this
+    // is nearly sorted already.
+    if (m_sprite_slot.size() < sprites.size()) m_sprite_slot.resize(sprites.size(), no_slot);
+    for (size_t k = 0; k < m_unsorted_sprites.size(); k++)
+        m_sprite_slot[m_unsorted_sprites[k].index] = uint32_t(k);
+
+    m_visible_sprites.clear();
+    for (uint32_t i : m_sprite_order)
+    {
+        if (i >= sprites.size() || m_sprite_slot[i] == no_slot) continue;
+        m_visible_sprites.push_back(m_unsorted_sprites[m_sprite_slot[i]]);
+        m_sprite_slot[i] = no_slot;
+    }
+    for (const SpriteProjection& proj : m_unsorted_sprites)
+    {
+        if (m_sprite_slot[proj.index] == no_slot) continue;
+        m_visible_sprites.push_back(proj);
+        m_sprite_slot[proj.index] = no_slot;
+    }
+
+    sort_sprites(m_visible_sprites);
+
+    m_sprite_order.clear();
+    for (const SpriteProjection& proj : m_visible_sprites)
+        m_sprite_order.push_back(uint32_t(proj.index));
 }
 
 
-void render(FrameBuffer& frame_buf, const GameState &game_state)
+void Renderer::render(FrameBuffer& frame_buf, const GameState &game_state)
 {
+    game_state.monsters.sprites(m_sprites);
+    render(frame_buf, game_state, game_state.player, m_sprites);
+}
+
+
+void Renderer::render(FrameBuffer& frame_buf, const GameState &game_state, const Player& camera)
+{
+    game_state.monsters.sprites(m_sprites);
+    render(frame_buf, game_state, camera, m_sprites);
+}
+
+
+void Renderer::render(FrameBuffer& frame_buf, const GameState &game_state, const Player& camera,
+                      const std::vector<Sprite>& sprites)
+{
+    PROFILE_SCOPE("render");
+    const auto start = std::chrono::steady_clock::now();
     const Map& map                     = game_state.map;
-    const Player& player               = game_state.player;
-    const std::vector<Sprite>& sprites = game_state.monsters;
+    const Player& player               = camera;
     const Texture& texture_walls       = game_state.texture_walls;
     const Texture& texture_monster     = game_state.texture_monster;
+    const double fog_dist              = m_settings.lighting ? m_settings.fog_dist : 0;  // 0 leaves everything unshaded
 
     const size_t frame_buf_w = frame_buf.width();
     const size_t frame_buf_h = frame_buf.height();
-    frame_buf.clear(pack_colour(255, 255, 255));
+    const size_t out_x = frame_buf_w/2;                // The 3D view fills the right half of the frame
+
+    // The view renders at its own resolution into m_view_pixels, then is scaled into the frame.
+    // The buffer is sized for the full resolution once, so changing the scale never allocates.
+    if (m_settings.target_ms <= 0)
+    {
+        m_render_scale = std::clamp(m_settings.render_scale, 0.05, 1.);
+        m_frame_ms = 0;
+    }
+    const size_t view_w = std::max<size_t>(1, size_t((frame_buf_w - out_x) * m_render_scale + 0.5));
+    const size_t view_h = std::max<size_t>(1, size_t(frame_buf_h * m_render_scale + 0.5));
+    const size_t view_pitch = view_pitch_for(frame_buf_w - out_x);
+    m_view_pixels.resize(std::max(m_view_pixels.size(), view_pitch * frame_buf_h));
+    FrameBuffer view_buf(view_w, view_h, m_view_pixels.data(), view_pitch);
 
     const size_t cell_w = frame_buf_w/(map.width()*2); // Size of one map cell on the screen
     const size_t cell_h = frame_buf_h/map.height();
-    std::vector<double> depth_buffer(frame_buf_w/2, 1e3);
-
-    // Draw FOV and 3D view
-    for (size_t i = 0; i < frame_buf_w/2; i++)
+    if (cell_w && cell_h) update_minimap(map, texture_walls, cell_w, cell_h);
     {
-        double angle = player.direction-player.fov/2 + player.fov*i/double(frame_buf_w/2);
+        PROFILE_SCOPE("clear");
+        // The upscaled view covers the right half of the frame and the cached minimap the top left
+        // corner: only the rest of the left half is cleared
+        const size_t minimap_w = (cell_w && cell_h) ? m_minimap.width() : 0;
+        const size_t minimap_h = (cell_w && cell_h) ? m_minimap.height() : 0;
+        frame_buf.draw_rectangle(minimap_w, 0, out_x - minimap_w, frame_buf_h, pack_colour(255, 255, 255));
+        frame_buf.draw_rectangle(0, minimap_h, minimap_w, frame_buf_h - minimap_h, pack_colour(255, 255, 255));
+        view_buf.clear(pack_colour(255, 255, 255));
+    }
+    m_depth_buffer.assign(view_w, 1e3);  // Keeps its capacity, so only the first frame allocates
+    m_ray_dist.resize(view_w);
+    m_wall_top.resize(view_w);
+    m_wall_bottom.resize(view_w);
+    select_kernels(texture_walls, texture_monster);
+
+    // The only trig of the frame: every column ray is the view direction rotated by its table entry
+    update_column_rays(player.fov, view_w);
+    const double dir_cos = cos(player.direction);
+    const double dir_sin = sin(player.direction);
 
-        // Draw player's line of sight by drawing hypotenuse t until hitting an object
-        for (double t = 0; t < 20; t += 0.01)
+    // Sprites standing in regions hidden from the camera's cell are skipped. The sets are sampled,
+    // so rays still run to max_ray_dist: a missed region costs a sprite, never a wall.
+    const bool inside = player.x_pos >= 0 && player.y_pos >= 0 && player.x_pos < map.width() && player.y_pos < map.height();
+    const Visibility* visibility = m_settings.pvs && inside && game_state.visibility.covers(map) ? &game_state.visibility : nullptr;
+
+    // Sprites are not bound by the rays: one shows wherever no wall stands in front of it, until
+    // it shrinks below a pixel view_h cells away. Culling only drops the ones farther than that or
+    // than the far corner of the map.
+    const double far_x = std::max(player.x_pos, map.width() - player.x_pos);
+    const double far_y = std::max(player.y_pos, map.height() - player.y_pos);
+    const double sprite_range = std::min(std::hypot(far_x, far_y), double(view_h)) + 1;
+
+    // Phase 1: cast rays and draw the 3D view. Each column only writes its own pixel column,
+    // its own depth_buffer slot, ray distance and wall rows, so columns run in parallel.
+    {
+        PROFILE_SCOPE("walls");
+        m_pool.parallel_for(view_w, m_settings.column_grain, [&](size_t col_begin, size_t col_end)
         {
-            double x = player.x_pos + t*cos(angle);
-            double y = player.y_pos + t*sin(angle);
-            frame_buf.set_pixel(x*cell_w, y*cell_h, pack_colour(190, 190, 190));
+            (this->*m_kernels.walls)(view_buf, game_state, player, dir_cos, dir_sin, col_begin, col_end);
+        });
+    }
 
-            if (map.is_empty(x, y)) continue;
+    // Then the floor and the ceiling around the walls, row by row
+    m_floor_ms = 0;
+    if (m_settings.floors && map.has_floor_layers())
+    {
+        PROFILE_SCOPE("floors");
+        const auto floors_start = std::chrono::steady_clock::now();
+        draw_floors(view_buf, map, texture_walls, player, dir_cos, dir_sin);
+        m_floor_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - floors_start).count();
+    }
+
+    {
+        PROFILE_SCOPE("sprite_cull");
+        cull_sprites(game_state, player, dir_cos, dir_sin, sprites, view_w, view_h, sprite_range, visibility);
+    }
 
-            // Ray touches a wall, so draw the vertical column to create illusion of 3D
-            size_t texture_id = map.get(x, y);
-            assert(texture_id < texture_walls.texture_count());
-            
-            double dist = t * cos(angle - player.direction);
-            depth_buffer[i] = dist;
+    // Phase 2: the map (left half) and the sprites (3D view) touch disjoint pixels. Task 0
+    // draws the whole map; the others each draw every sprite clipped to their own column tile,
+    // which keeps the back to front sprite order within each tile.
+    const size_t tile_w = m_settings.sprite_tile_w;
+    const size_t tile_count = (view_w + tile_w - 1) / tile_w;
 
-            size_t column_height = frame_buf_h/(t*cos(angle - player.direction));
-            int texture_x = wall_x_coord(x, y, texture_walls);
-            
-            const std::vector<uint32_t>& column = texture_walls.get_scaled_column(texture_id, texture_x, column_height);
-            int pix_x = i + frame_buf_w/2; // Right half of the screen so +frame_buf.w/2
-            
-            // Copy the texture column to the framebuffer
-            for (size_t j=0; j<column_height; j++) 
+    m_pool.parallel_for(tile_count + 1, 1, [&](size_t task_begin, size_t task_end)
+    {
+        for (size_t task = task_begin; task < task_end; task++)
+        {
+            if (task == 0)
             {
-                int pix_y = j + frame_buf_h/2 - column_height/2;
-                if ((pix_y >= 0) && (pix_y < (int)frame_buf_h)) 
+                PROFILE_SCOPE("minimap");
+                if (!cell_w || !cell_h) continue;  // Map too large to draw one pixel per cell
+
+                // Copy the cached walls, then draw what moves over them
+                for (size_t j = 0; j < m_minimap.height(); j++)
+                    std::memcpy(frame_buf.pixel_ptr(0, j), m_minimap.pixel_ptr(0, j), m_minimap.width() * sizeof(uint32_t));
+
+                for (size_t i = 0; i < view_w; i++)
                 {
-                    frame_buf.set_pixel(pix_x, pix_y, column[j]);
+                    const ColumnRay& column = m_column_rays[i];
+                    draw_ray_line(frame_buf, map, player, dir_cos*column.cos_offset - dir_sin*column.sin_offset,
+                                  dir_sin*column.cos_offset + dir_cos*column.sin_offset, m_ray_dist[i], cell_w, cell_h);
                 }
+
+                draw_map_sprites(frame_buf, sprites, cell_w, cell_h);
+                continue;
             }
-            break;
-        }
-    }
 
-    draw_map(frame_buf, sprites, texture_walls, map, cell_w, cell_h);
+            PROFILE_SCOPE("sprites");
+            const size_t col_begin = (task - 1) * tile_w;
+            const size_t col_end = std::min(col_begin + tile_w, view_w);
+            for (const SpriteProjection& proj : m_visible_sprites)
+            {
+                m_kernels.sprite(view_buf, proj, sprites[proj.index].texture_id, m_depth_buffer, texture_monster, col_begin,
+                                 col_end, fog_dist);
+            }
+        }
+    });
 
-    for (size_t i = 0; i < sprites.size(); i++)
     {
-        draw_sprite(frame_buf, sprites[i], depth_buffer, player, texture_monster);
+        PROFILE_SCOPE("upscale");
+        upscale_view(view_buf, frame_buf, out_x);
     }
+
+    if (m_settings.target_ms > 0)
+        adapt_render_scale(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
 }
@@ -6,22 +6,169 @@
 #include "map.h"
 #include "player.h"
 #include "sprite.h"
+#include "monsters.h"
 #include "framebuffer.h"
 #include "textures.h"
+#include "thread_pool.h"
+#include "visibility.h"
+
+
+// Ray traversal strategy used for the 3D view
+enum class RayCaster
+{
+    march,  // Fixed-step marching along the ray (legacy, kept for benchmarking)
+    dda     // Grid-exact cell to cell traversal
+};
+
+
+struct RenderSettings
+{
+    RayCaster ray_caster = RayCaster::dda;
+    size_t thread_count  = 0;   // Render threads including the caller, 0 = one per hardware thread
+    size_t column_grain  = 8;   // Columns per work-stealing chunk
+    size_t sprite_tile_w = 64;  // Width of the column tiles sprites are drawn in
+    double max_ray_dist  = 20;  // Rays stop after this many cells
+    bool skip_empty      = true;  // DDA jumps across empty space when the map has a distance field
+    bool cull_sprites    = true;  // Only project sprites near the view cone, through a grid
+    double render_scale  = 1;     // 3D view resolution relative to the window, upscaled when below 1
+    double target_ms     = 0;     // When not 0, the scale adapts every frame to render in this time instead
+    double min_scale     = 0.25;  // Lowest scale the adaptive mode goes down to
+    bool floors          = true;  // Texture the floor and the ceiling where the map has floor layers
+    bool lighting        = true;  // Fade with distance, through the textures' shaded copies (TextureOptions::shade_levels)
+    double fog_dist      = 16;    // Distance the last shaded copy is reached at
+    size_t floor_grain   = 4;     // Floor rows per work-stealing chunk
+    bool pvs             = false; // With GameState::visibility built for the map, skip sprites in regions
+                                  // hidden from the camera's. The sets are sampled, so off unless asked for.
+    bool specialize      = true;  // Draw with kernels compiled for the texture sizes and features in use, when
+                                  // there are some (power of two textures of 32 to 256 texels); generic ones otherwise
+};
 
 
 struct GameState
 {
     Map map;
     Player player;
-    std::vector<Sprite> monsters;
+    MonsterSystem monsters;
     Texture texture_walls;
     Texture texture_monster;
+    Visibility visibility;  // Potentially visible sets of map, or none
 };
 
-bool update_player_state(GameState& game_state);
 void update_player_position(GameState& game_state);
-void render(FrameBuffer& frame_buf, const GameState& game_state);
+
+
+// Screen placement of a sprite in the 3D view: a size x size square at (h_offset, v_offset)
+struct SpriteProjection
+{
+    size_t index;  // Into the sprites rendered
+    double dist;
+    int h_offset;
+    int v_offset;
+    size_t size;
+};
+
+
+// Direction of a column's ray relative to the view direction, as the cosine and sine of the
+// angle between them. cos_offset is also the fisheye correction: wall distance = ray length * cos_offset.
+// tan_offset places the column's floor point sideways from the view direction, per unit of distance.
+struct ColumnRay
+{
+    double cos_offset;
+    double sin_offset;
+    double tan_offset;
+};
+
+
+// Owns the render worker pool and the scratch buffers reused from frame to frame
+class Renderer
+{
+    RenderSettings m_settings;
+    ThreadPool m_pool;
+    std::vector<double> m_depth_buffer;  // Perpendicular wall distance per column
+    std::vector<double> m_ray_dist;      // Ray length per column, for drawing the rays on the map
+    std::vector<int32_t> m_wall_top;     // View rows [top, bottom) covered by each column's wall
+    std::vector<int32_t> m_wall_bottom;
+    std::vector<ColumnRay> m_column_rays;  // Per column, rebuilt when the fov or the view width changes
+    double m_column_rays_fov;
+    SpriteGrid m_sprite_grid;
+    std::vector<uint32_t> m_sprite_candidates;
+    std::vector<SpriteProjection> m_visible_sprites;  // Far to near
+    std::vector<SpriteProjection> m_unsorted_sprites; // This frame's projections, in candidate order
+    std::vector<uint32_t> m_sprite_order;  // Sprite indices of the last frame's m_visible_sprites
+    std::vector<uint32_t> m_sprite_slot;   // Per sprite, its slot in m_unsorted_sprites or no_slot
+    std::vector<Sprite> m_sprites;       // game_state.monsters, when rendering without a snapshot
+    FrameBuffer m_minimap;               // Map walls at the current cell size, copied in every frame
+    const Map* m_minimap_map;
+    size_t m_minimap_cell_w;
+    size_t m_minimap_cell_h;
+    std::vector<uint32_t> m_view_pixels;   // The 3D view at its render resolution
+    std::vector<uint32_t> m_upscale_cols;  // View column sampled by each output column
+    double m_render_scale;
+    double m_frame_ms;                     // Smoothed render time, for the adaptive scale
+    double m_floor_ms;                     // Floor and ceiling time of the last frame
+
+    // Kernels drawing wall columns and one sprite in one column tile. Each is a template
+    // instantiated per texture size (log2, 0 for the generic one) and feature set.
+    typedef void (Renderer::*WallKernel)(FrameBuffer& view_buf, const GameState& game_state, const Player& player,
+                                         const double dir_cos, const double dir_sin, const size_t col_begin,
+                                         const size_t col_end);
+    typedef void (*SpriteKernel)(FrameBuffer& fb, const SpriteProjection& proj, const size_t texture_id,
+                                 const std::vector<double>& depth_buffer, const Texture& tex_sprites,
+                                 const size_t col_begin, const size_t col_end, const double fog_dist);
+
+    // The kernels in use, picked again only when the textures or the settings they depend on change
+    struct Kernels
+    {
+        size_t wall_size;
+        size_t sprite_size;
+        bool specialize;
+        bool lighting;
+        bool specialized;  // Instantiations for both sizes were found
+        WallKernel walls;
+        SpriteKernel sprite;
+    };
+    Kernels m_kernels;
+
+    void select_kernels(const Texture& texture_walls, const Texture& texture_monster);
+    template <unsigned size_shift, bool lighting>
+    void draw_walls(FrameBuffer& view_buf, const GameState& game_state, const Player& player, const double dir_cos,
+                    const double dir_sin, const size_t col_begin, const size_t col_end);
+    void update_column_rays(const double fov, const size_t view_w);
+    void update_minimap(const Map& map, const Texture& texture_walls, const size_t cell_w, const size_t cell_h);
+    void adapt_render_scale(const double frame_ms);
+    void upscale_view(const FrameBuffer& view_buf, FrameBuffer& frame_buf, const size_t out_x);
+    void draw_floors(FrameBuffer& view_buf, const Map& map, const Texture& texture_walls, const Player& player,
+                     const double dir_cos, const double dir_sin);
+    void cull_sprites(const GameState& game_state, const Player& player, const double dir_cos, const double dir_sin,
+                      const std::vector<Sprite>& sprites, const size_t view_w, const size_t view_h,
+                      const double range, const Visibility* visibility);
+
+public:
+    explicit Renderer(const RenderSettings& settings = RenderSettings());
+
+    // Settings other than thread_count can be changed between frames
+    RenderSettings& settings();
+    size_t thread_count() const;
+
+    // Scale the last frame was rendered at: settings().render_scale, or the adaptive one
+    double render_scale() const;
+
+    // Time the floor and the ceiling took in the last frame, in ms
+    double floor_ms() const;
+
+    // Whether the last frame's walls and sprites were both drawn with kernels specialised for their textures
+    bool specialized() const;
+
+    void render(FrameBuffer& frame_buf, const GameState& game_state);
+
+    // Render from camera instead of game_state.player, e.g. interpolated between simulation ticks
+    void render(FrameBuffer& frame_buf, const GameState& game_state, const Player& camera);
+
+    // Render a snapshot of the moving parts (camera and sprites, in any order) so the
+    // simulation can carry on updating game_state while the frame is drawn on another thread
+    void render(FrameBuffer& frame_buf, const GameState& game_state, const Player& camera,
+                const std::vector<Sprite>& sprites);
+};
 
 
 #endif
\ No newline at end of file
@@ -1,5 +1,69 @@
+#include <algorithm>
+
 #include "sprite.h"
 
-bool Sprite::operator<(const Sprite& sprite) const {
-      return player_dist > sprite.player_dist;
-}
\ No newline at end of file
+SpriteGrid::SpriteGrid(const size_t bucket_size)
+    : m_bucket_size(bucket_size), m_cols(0), m_rows(0)
+{
+    if (!m_bucket_size) m_bucket_size = 1;
+}
+
+
+size_t SpriteGrid::bucket_col(const double x) const
+{
+    if (!(x > 0)) return 0;
+    return std::min(size_t(x) / m_bucket_size, m_cols - 1);
+}
+
+
+size_t SpriteGrid::bucket_row(const double y) const
+{
+    if (!(y > 0)) return 0;
+    return std::min(size_t(y) / m_bucket_size, m_rows - 1);
+}
+
+
+void SpriteGrid::build(const std::vector<Sprite>& sprites, const size_t map_w, const size_t map_h)
+{
+    // Sprites outside the map are clamped into the border buckets
+    m_cols = std::max<size_t>(1, (map_w + m_bucket_size - 1) / m_bucket_size);
+    m_rows = std::max<size_t>(1, (map_h + m_bucket_size - 1) / m_bucket_size);
+
+    // Counting sort of the sprite indices by bucket
+    m_offsets.assign(m_cols * m_rows + 1, 0);
+    m_bucket_of.resize(sprites.size());
+    m_indices.resize(sprites.size());
+
+    for (size_t i = 0; i < sprites.size(); i++)
+    {
+        m_bucket_of[i] = uint32_t(bucket_col(sprites[i].x_pos) + bucket_row(sprites[i].y_pos) * m_cols);
+        m_offsets[m_bucket_of[i] + 1]++;
+    }
+    for (size_t b = 0; b < m_cols * m_rows; b++)
+        m_offsets[b + 1] += m_offsets[b];
+
+    for (size_t i = 0; i < sprites.size(); i++)
+        m_indices[m_offsets[m_bucket_of[i]]++] = uint32_t(i);
+
+    // The scatter advanced every offset to the end of its bucket: shift them back by one bucket
+    for (size_t b = m_cols * m_rows; b > 0; b--)
+        m_offsets[b] = m_offsets[b - 1];
+    m_offsets[0] = 0;
+}
+
+
+void SpriteGrid::query(const double x0, const double y0, const double x1, const double y1, std::vector<uint32_t>& out) const
+{
+    if (m_indices.empty()) return;
+
+    const size_t col_end = bucket_col(x1) + 1;
+    const size_t row_end = bucket_row(y1) + 1;
+
+    for (size_t row = bucket_row(y0); row < row_end; row++)
+    {
+        const size_t first = bucket_col(x0) + row * m_cols;
+        const size_t last = col_end - 1 + row * m_cols;
+        // Buckets of one row are contiguous in m_indices
+        out.insert(out.end(), m_indices.begin() + m_offsets[first], m_indices.begin() + m_offsets[last + 1]);
+    }
+}
@@ -2,6 +2,8 @@
 #define SPRITE_H
 
 #include <cstdlib>
+#include <cstdint>
+#include <vector>
 
 
 struct Sprite
@@ -9,10 +11,32 @@ struct Sprite
     double x_pos;
     double y_pos;
     size_t texture_id;
-    double player_dist;
+};
+
+
+// Uniform grid over the map bucketing sprite indices by position, so the renderer only looks at
+// the sprites near the view cone. Rebuilt from scratch every frame, reusing its storage.
+class SpriteGrid
+{
+    size_t m_bucket_size;            // Map cells along each side of a bucket
+    size_t m_cols;
+    size_t m_rows;
+    std::vector<uint32_t> m_offsets;  // Bucket b holds m_indices[m_offsets[b], m_offsets[b+1])
+    std::vector<uint32_t> m_indices;
+    std::vector<uint32_t> m_bucket_of;
+
+    size_t bucket_col(const double x) const;
+    size_t bucket_row(const double y) const;
+
+public:
+    explicit SpriteGrid(const size_t bucket_size = 8);
+
+    void build(const std::vector<Sprite>& sprites, const size_t map_w, const size_t map_h);
 
-    bool operator<(const Sprite& sprite) const;
+    // Append the indices of the sprites in every bucket overlapping [x0,x1] x [y0,y1]. Within a
+    // bucket indices are ascending; across buckets they are not.
+    void query(const double x0, const double y0, const double x1, const double y1, std::vector<uint32_t>& out) const;
 };
 
 
-#endif
\ No newline at end of file
+#endif
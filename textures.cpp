@@ -1,74 +1,464 @@
 #include <iostream>
+#include <fstream>
 #include <vector>
 #include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
+#include <future>
 #include "SDL.h"
 
 #include "utils.h"
 #include "textures.h"
+#include "blit.h"
 
 
-Texture::Texture(const std::string& filename, const uint32_t format)
-    : m_img_w(0), m_img_h(0), m_texture_count(0), m_texture_size(0), m_img() 
+// Cache file header, also kept at the front of the in-memory storage. Section offsets are in bytes
+// from the start of the header; levels, runs and run_offsets are set for the sampling levels only,
+// shades when there are shaded copies.
+struct TextureCacheHeader
+{
+    char magic[8];
+    uint64_t source_size;   // Bitmap the cache was built from
+    int64_t source_time;
+    uint32_t format;
+    uint32_t img_w;
+    uint32_t img_h;
+    uint32_t texture_count;
+    uint32_t texture_size;
+    uint32_t layout;
+    uint32_t mipmaps;
+    uint32_t level_count;
+    uint32_t shade_levels;
+    uint32_t fog_colour;
+    uint64_t total_bytes;
+    uint64_t img;
+    uint64_t levels[Texture::max_levels];
+    uint64_t runs[Texture::max_levels];
+    uint64_t run_offsets[Texture::max_levels];
+    uint64_t shades;
+};
+static_assert(sizeof(TextureCacheHeader) == 472, "texture cache header must stay 472 bytes");
+
+static const char texture_magic[8] = {'F', 'P', 'S', 'T', 'E', 'X', '2', '\0'};
+
+
+// Texel offset of each sampling level within one shaded copy, and the texels in a whole copy
+static size_t shade_layout(const TextureCacheHeader& header, size_t offsets[Texture::max_levels])
+{
+    offsets[0] = 0;
+    if (!header.level_count) return size_t(header.img_w) * header.img_h;
+
+    size_t texels = 0;
+    for (size_t level = 0; level < header.level_count; level++)
+    {
+        const size_t size = header.texture_size >> level;
+        offsets[level] = texels;
+        texels += size_t(header.texture_count) * size * size;
+    }
+    return texels;
+}
+
+
+static size_t clamp_shade_levels(const size_t shade_levels)
+{
+    return std::clamp<size_t>(shade_levels, 1, Texture::max_shades);
+}
+
+
+// Blend s/shade_levels of the way from colour to fog, keeping the alpha
+static uint32_t shade_colour(const uint32_t colour, const uint32_t fog, const uint32_t s, const uint32_t shade_levels)
+{
+    uint8_t r, g, b, a, fog_r, fog_g, fog_b, fog_a;
+    unpack_colour(colour, r, g, b, a);
+    unpack_colour(fog, fog_r, fog_g, fog_b, fog_a);
+    const uint32_t keep = shade_levels - s;
+    return pack_colour((r*keep + fog_r*s) / shade_levels, (g*keep + fog_g*s) / shade_levels,
+                       (b*keep + fog_b*s) / shade_levels, a);
+}
+
+
+Texture::Texture(const std::string& filename, const uint32_t format, const TextureOptions& options)
+    : m_img_w(0), m_img_h(0), m_texture_count(0), m_texture_size(0), m_options(options), m_storage(),
+      m_storage_bytes(0), m_from_cache(false), m_img(nullptr), m_level_count(0), m_levels(), m_runs(),
+      m_run_offsets(), m_shade_levels(1), m_shades(nullptr), m_shade_stride(0), m_shade_offsets()
+{
+    // The cache is keyed on the bitmap's size and modification time
+    std::error_code ec;
+    const uint64_t source_size = std::filesystem::file_size(filename, ec);
+    const int64_t source_time = ec ? 0 : int64_t(std::filesystem::last_write_time(filename, ec).time_since_epoch().count());
+
+    std::string cache_file;
+    if (!options.cache_dir.empty() && !ec)
+    {
+        const bool column_major = options.layout == TextureLayout::column_major;
+        const size_t shade_levels = clamp_shade_levels(options.shade_levels);
+        const std::string tag = std::string(column_major ? (options.mipmaps ? ".column-mip" : ".column") : ".atlas")
+                              + (shade_levels > 1 ? ".shade" + std::to_string(shade_levels) : "");
+        cache_file = (std::filesystem::path(options.cache_dir) / (std::filesystem::path(filename).stem().string() + tag + ".texcache")).string();
+        if (load_cache(cache_file, source_size, source_time, format)) return;
+    }
+
+    std::vector<uint32_t> img;
+    if (!load_bitmap(filename, format, img)) return;
+    build(img, source_size, source_time, format);
+
+    if (cache_file.empty()) return;
+
+    // Written aside then renamed, so a concurrent start never maps a half written cache
+    const std::string tmp_file = cache_file + ".tmp";
+    std::filesystem::create_directories(options.cache_dir, ec);
+    std::ofstream ofs(tmp_file, std::ios::binary);
+    ofs.write(static_cast<const char*>(m_storage.get()), m_storage_bytes);
+    ofs.close();
+    if (ofs) std::filesystem::rename(tmp_file, cache_file, ec);
+    if (!ofs || ec)
+    {
+        std::cerr << "Error: cannot write texture cache " << cache_file << std::endl;
+        std::filesystem::remove(tmp_file, ec);
+    }
+}
+
+
+bool Texture::load_bitmap(const std::string& filename, const uint32_t format, std::vector<uint32_t>& img)
 {
     SDL_Surface* tmp = SDL_LoadBMP(filename.c_str());
 
     if (!tmp)
     {
         std::cerr << "Error in SDL_LoadBMP: " << SDL_GetError() << std::endl;
-        return;
+        return false;
     }
 
     SDL_Surface* surface = SDL_ConvertSurfaceFormat(tmp, format, 0);
     SDL_FreeSurface(tmp);
-    
+
     if (!surface)
     {
         std::cerr << "Error in SDL_ConvertSurfaceFormat: " << SDL_GetError() << std::endl;
-        return;
+        return false;
     }
 
     int w = surface->w;
     int h = surface->h;
 
-    if ((w * 4) != surface->pitch)
+    if (surface->pitch < w * 4)
     {
         std::cerr << "Error: the texture must be a 32 bit image" << std::endl;
         SDL_FreeSurface(surface);
-        return;
+        return false;
     }
 
-    if (w != (h * int(w/h)))
+    if (!h || w != (h * int(w/h)))
     {
         std::cerr << "Error: the texture file must contain N square textures packed horizontally" << std::endl;
         SDL_FreeSurface(surface);
-        return;
+        return false;
     }
 
     m_texture_count = w/h;
     m_texture_size = w/m_texture_count;
     m_img_w = w;
     m_img_h = h;
-    uint8_t* pixmap = reinterpret_cast<uint8_t*>(surface->pixels);
 
-    m_img = std::vector<uint32_t>(w*h);
+    // Packed formats such as ABGR8888 are defined on native 32 bit words, the same words
+    // pack_colour builds, so whole rows are copied as they are
+    img.resize(size_t(w) * h);
+    const uint8_t* pixmap = static_cast<const uint8_t*>(surface->pixels);
     for (int j = 0; j < h; j++)
+        std::memcpy(&img[size_t(j) * w], pixmap + size_t(j) * surface->pitch, size_t(w) * sizeof(uint32_t));
+
+    SDL_FreeSurface(surface);
+    return true;
+}
+
+
+// Average of four texels weighted by their alpha, so fully transparent texels (whatever colour
+// the sprite sheet keys them with) do not bleed into the edges of opaque areas
+static uint32_t box_filter(const uint32_t c0, const uint32_t c1, const uint32_t c2, const uint32_t c3)
+{
+    const uint32_t texels[4] = {c0, c1, c2, c3};
+    uint32_t sum_r = 0, sum_g = 0, sum_b = 0, sum_a = 0;
+
+    for (uint32_t colour : texels)
+    {
+        uint8_t r, g, b, a;
+        unpack_colour(colour, r, g, b, a);
+        sum_r += r * a;
+        sum_g += g * a;
+        sum_b += b * a;
+        sum_a += a;
+    }
+
+    if (!sum_a) return pack_colour(0, 0, 0, 0);
+    return pack_colour(sum_r / sum_a, sum_g / sum_a, sum_b / sum_a, (sum_a + 2) / 4);
+}
+
+
+// Build the column-major levels and the opaque runs from the decoded atlas, then lay everything
+// out in one block in the cache file format
+void Texture::build(const std::vector<uint32_t>& img, const uint64_t source_size, const int64_t source_time,
+                    const uint32_t format)
+{
+    const size_t count = m_texture_count;
+    std::vector<std::vector<uint32_t>> levels;
+
+    if (m_options.layout == TextureLayout::column_major)
     {
-         for (int i = 0; i < w; i++)
-         {
-            uint8_t r = pixmap[(i + j*w)*4 + 0];
-            uint8_t g = pixmap[(i + j*w)*4 + 1];
-            uint8_t b = pixmap[(i + j*w)*4 + 2];
-            uint8_t a = pixmap[(i + j*w)*4 + 3];
-            m_img[i + j*w] = pack_colour(r, g, b, a);
+        std::vector<uint32_t> columns(img.size());
+        for (size_t idx = 0; idx < count; idx++)
+            for (size_t i = 0; i < m_texture_size; i++)
+                for (size_t j = 0; j < m_texture_size; j++)
+                    columns[(idx*m_texture_size + i)*m_texture_size + j] = img[i + idx*m_texture_size + j*m_img_w];
+        levels.push_back(std::move(columns));
+
+        for (size_t size = m_texture_size; m_options.mipmaps && size > 1 && size % 2 == 0 && levels.size() < max_levels; size /= 2)
+        {
+            const std::vector<uint32_t>& src = levels.back();
+            const size_t half = size / 2;
+            std::vector<uint32_t> level(count * half * half);
+
+            for (size_t idx = 0; idx < count; idx++)
+            {
+                for (size_t i = 0; i < half; i++)
+                {
+                    const uint32_t* col0 = &src[(idx*size + 2*i)*size];
+                    const uint32_t* col1 = col0 + size;
+                    for (size_t j = 0; j < half; j++)
+                        level[(idx*half + i)*half + j] = box_filter(col0[2*j], col0[2*j + 1], col1[2*j], col1[2*j + 1]);
+                }
+            }
+
+            levels.push_back(std::move(level));
         }
     }
-    
-    SDL_FreeSurface(surface);
+
+    const size_t sampling_levels = std::max<size_t>(1, levels.size());
+    std::vector<std::vector<OpaqueRun>> runs(sampling_levels);
+    std::vector<std::vector<uint32_t>> run_offsets(sampling_levels);
+
+    for (size_t level = 0; level < sampling_levels; level++)
+    {
+        const size_t size = m_texture_size >> level;
+        run_offsets[level].reserve(count * size + 1);
+        run_offsets[level].push_back(0);
+
+        for (size_t idx = 0; idx < count; idx++)
+        {
+            for (size_t i = 0; i < size; i++)
+            {
+                const uint32_t* column = levels.empty() ? nullptr : &levels[level][(idx*size + i)*size];
+                size_t j = 0;
+                while (j < size)
+                {
+                    auto texel = [&](const size_t row) { return column ? column[row] : img[i + idx*m_texture_size + row*m_img_w]; };
+                    while (j < size && !is_opaque(texel(j))) j++;
+                    const size_t begin = j;
+                    while (j < size && is_opaque(texel(j))) j++;
+                    if (begin < j) runs[level].push_back(OpaqueRun{uint32_t(begin), uint32_t(j)});
+                }
+                run_offsets[level].push_back(uint32_t(runs[level].size()));
+            }
+        }
+    }
+
+    TextureCacheHeader header{};
+    std::memcpy(header.magic, texture_magic, sizeof(texture_magic));
+    header.source_size   = source_size;
+    header.source_time   = source_time;
+    header.format        = format;
+    header.img_w         = uint32_t(m_img_w);
+    header.img_h         = uint32_t(m_img_h);
+    header.texture_count = uint32_t(count);
+    header.texture_size  = uint32_t(m_texture_size);
+    header.layout        = uint32_t(m_options.layout);
+    header.mipmaps       = m_options.mipmaps;
+    header.level_count   = uint32_t(levels.size());
+    header.shade_levels  = uint32_t(clamp_shade_levels(m_options.shade_levels));
+    header.fog_colour    = header.shade_levels > 1 ? m_options.fog_colour : 0;
+
+    size_t shade_offsets[max_levels];
+    const size_t shade_stride = shade_layout(header, shade_offsets);
+
+    size_t bytes = sizeof(header);
+    auto section = [&](const size_t size)
+    {
+        bytes = (bytes + 63) / 64 * 64;
+        const size_t offset = bytes;
+        bytes += size;
+        return offset;
+    };
+    header.img = section(img.size() * sizeof(uint32_t));
+    for (size_t level = 0; level < sampling_levels; level++)
+    {
+        if (level < levels.size()) header.levels[level] = section(levels[level].size() * sizeof(uint32_t));
+        header.runs[level] = section(runs[level].size() * sizeof(OpaqueRun));
+        header.run_offsets[level] = section(run_offsets[level].size() * sizeof(uint32_t));
+    }
+    if (header.shade_levels > 1)
+        header.shades = section((header.shade_levels - 1) * shade_stride * sizeof(uint32_t));
+    header.total_bytes = bytes;
+
+    std::shared_ptr<std::vector<uint64_t>> buffer = std::make_shared<std::vector<uint64_t>>((bytes + 7) / 8, 0);
+    uint8_t* base = reinterpret_cast<uint8_t*>(buffer->data());
+    std::memcpy(base, &header, sizeof(header));
+    std::memcpy(base + header.img, img.data(), img.size() * sizeof(uint32_t));
+    for (size_t level = 0; level < sampling_levels; level++)
+    {
+        if (level < levels.size())
+            std::memcpy(base + header.levels[level], levels[level].data(), levels[level].size() * sizeof(uint32_t));
+        std::memcpy(base + header.runs[level], runs[level].data(), runs[level].size() * sizeof(OpaqueRun));
+        std::memcpy(base + header.run_offsets[level], run_offsets[level].data(), run_offsets[level].size() * sizeof(uint32_t));
+    }
+
+    uint32_t* shades = reinterpret_cast<uint32_t*>(base + header.shades);
+    for (uint32_t s = 1; s < header.shade_levels; s++)
+    {
+        for (size_t level = 0; level < sampling_levels; level++)
+        {
+            const std::vector<uint32_t>& src = levels.empty() ? img : levels[level];
+            uint32_t* dst = shades + (s - 1)*shade_stride + shade_offsets[level];
+            for (size_t k = 0; k < src.size(); k++)
+                dst[k] = shade_colour(src[k], header.fog_colour, s, header.shade_levels);
+        }
+    }
+
+    assign_storage(std::shared_ptr<const void>(buffer, buffer->data()), bytes);
+}
+
+
+// Whether the run offsets of every column rise from 0 and every run lies in [0, level_size) with
+// begin < end, so drawing a column from a cache file stays inside the runs and the texels
+bool Texture::runs_valid(const uint32_t* offsets, const OpaqueRun* runs, const size_t columns, const size_t level_size)
+{
+    if (offsets[0] != 0) return false;
+    for (size_t c = 0; c < columns; c++)
+    {
+        if (offsets[c + 1] < offsets[c]) return false;
+        for (size_t r = offsets[c]; r < offsets[c + 1]; r++)
+            if (runs[r].begin >= runs[r].end || runs[r].end > level_size) return false;
+    }
+    return true;
+}
+
+
+bool Texture::load_cache(const std::string& cache_file, const uint64_t source_size, const int64_t source_time,
+                         const uint32_t format)
+{
+    if (!std::filesystem::exists(cache_file)) return false;
+
+    size_t file_size = 0;
+    std::shared_ptr<const void> storage = map_file(cache_file, file_size);
+
+    TextureCacheHeader header{};
+    if (file_size >= sizeof(header)) std::memcpy(&header, storage.get(), sizeof(header));
+
+    // A stale cache (other bitmap or options) is quietly rebuilt, a damaged one is reported first
+    const bool column_major = m_options.layout == TextureLayout::column_major;
+    if (std::memcmp(header.magic, texture_magic, sizeof(texture_magic)) || header.source_size != source_size
+        || header.source_time != source_time || header.format != format || header.layout != uint32_t(m_options.layout)
+        || (column_major && header.mipmaps != uint32_t(m_options.mipmaps))
+        || header.shade_levels != clamp_shade_levels(m_options.shade_levels)
+        || (header.shade_levels > 1 && header.fog_colour != m_options.fog_colour))
+    {
+        return false;
+    }
+
+    const uint8_t* base = static_cast<const uint8_t*>(storage.get());
+    const size_t size = header.texture_size;
+    const size_t sampling_levels = std::max<uint32_t>(1, header.level_count);
+    auto fits = [&](const uint64_t offset, const uint64_t bytes) { return offset % 8 == 0 && offset <= header.total_bytes && bytes <= header.total_bytes - offset; };
+
+    bool valid = header.total_bytes <= file_size && size && header.texture_count
+                 && header.img_w == header.texture_count * size && header.img_h == size
+                 && header.level_count <= max_levels && (column_major ? header.level_count > 0 : header.level_count == 0)
+                 && fits(header.img, uint64_t(header.img_w) * header.img_h * sizeof(uint32_t));
+    for (size_t level = 0; valid && level < sampling_levels; level++)
+    {
+        const size_t columns = header.texture_count * (size >> level);
+        valid = (size >> level) > 0
+                && (level >= header.level_count || fits(header.levels[level], uint64_t(columns) * (size >> level) * sizeof(uint32_t)))
+                && fits(header.run_offsets[level], (columns + 1) * sizeof(uint32_t));
+        if (valid)
+        {
+            const uint32_t* offsets = reinterpret_cast<const uint32_t*>(base + header.run_offsets[level]);
+            valid = fits(header.runs[level], uint64_t(offsets[columns]) * sizeof(OpaqueRun))
+                    && runs_valid(offsets, reinterpret_cast<const OpaqueRun*>(base + header.runs[level]), columns,
+                                  size >> level);
+        }
+    }
+    if (valid && header.shade_levels > 1)
+    {
+        size_t shade_offsets[max_levels];
+        valid = fits(header.shades, uint64_t(header.shade_levels - 1) * shade_layout(header, shade_offsets) * sizeof(uint32_t));
+    }
+
+    if (!valid)
+    {
+        std::cerr << "Error: texture cache " << cache_file << " is truncated or corrupt, rebuilding it" << std::endl;
+        return false;
+    }
+
+    assign_storage(storage, header.total_bytes);
+    m_from_cache = true;
+    return true;
+}
+
+
+void Texture::assign_storage(const std::shared_ptr<const void>& storage, const size_t bytes)
+{
+    TextureCacheHeader header;
+    std::memcpy(&header, storage.get(), sizeof(header));
+    const uint8_t* base = static_cast<const uint8_t*>(storage.get());
+
+    m_img_w         = header.img_w;
+    m_img_h         = header.img_h;
+    m_texture_count = header.texture_count;
+    m_texture_size  = header.texture_size;
+    m_img           = reinterpret_cast<const uint32_t*>(base + header.img);
+    m_level_count   = header.level_count;
+
+    for (size_t level = 0; level < max_levels; level++)
+    {
+        const bool sampled = level < std::max<size_t>(1, m_level_count);
+        m_levels[level]      = level < m_level_count ? reinterpret_cast<const uint32_t*>(base + header.levels[level]) : nullptr;
+        m_runs[level]        = sampled ? reinterpret_cast<const OpaqueRun*>(base + header.runs[level]) : nullptr;
+        m_run_offsets[level] = sampled ? reinterpret_cast<const uint32_t*>(base + header.run_offsets[level]) : nullptr;
+    }
+
+    m_shade_levels = header.shade_levels;
+    m_shades       = m_shade_levels > 1 ? reinterpret_cast<const uint32_t*>(base + header.shades) : nullptr;
+    m_shade_stride = shade_layout(header, m_shade_offsets);
+
+    m_storage = storage;
+    m_storage_bytes = bytes;
+}
+
+
+const uint32_t* Texture::sampled_texels(const size_t level, const size_t shade) const
+{
+    assert(level < mip_levels() && shade < m_shade_levels);
+    if (shade) return m_shades + (shade - 1)*m_shade_stride + m_shade_offsets[level];
+    return m_level_count ? m_levels[level] : m_img;
 }
 
 
 size_t Texture::texture_size() const { return m_texture_size; }
 size_t Texture::texture_count() const { return m_texture_count; }
+TextureLayout Texture::layout() const { return m_options.layout; }
+size_t Texture::mip_levels() const { return std::max<size_t>(1, m_level_count); }
+size_t Texture::memory_bytes() const { return m_storage_bytes; }
+bool Texture::from_cache() const { return m_from_cache; }
+size_t Texture::shade_levels() const { return m_shade_levels; }
+
+
+size_t Texture::mip_level(const size_t out_size) const
+{
+    size_t level = 0;
+    while (level + 1 < mip_levels() && (m_texture_size >> (level + 1)) >= out_size)
+        level++;
+    return level;
+}
 
 
 uint32_t Texture::get_px_from_texture(const size_t i, const size_t j, const size_t idx) const
@@ -78,15 +468,150 @@ uint32_t Texture::get_px_from_texture(const size_t i, const size_t j, const size
 }
 
 
-std::vector<uint32_t> Texture::get_scaled_column(const size_t texture_id, const size_t texture_coord, const size_t column_height) const
+Texture::TexelView Texture::texel_view(const size_t level, const size_t shade) const
 {
-    assert((texture_coord < m_texture_size) && (texture_id < m_texture_count));
-    std::vector<uint32_t> column(column_height);
-    
-    for (size_t y = 0; y < column_height; y++)
+    const size_t size = m_texture_size >> level;
+
+    if (m_level_count)
+        return TexelView{sampled_texels(level, shade), size, size*size, size, 1};
+    return TexelView{sampled_texels(level, shade), m_texture_size, m_texture_size, 1, m_img_w};
+}
+
+
+void Texture::copy_scaled_column(const size_t texture_id, const size_t texture_coord, const size_t column_height,
+                                 const size_t row_begin, const size_t row_end,
+                                 uint32_t* dst, const size_t dst_stride, const bool alpha_test,
+                                 const size_t level, const size_t shade) const
+{
+    assert((texture_coord < m_texture_size) && (texture_id < m_texture_count)
+           && (row_begin <= row_end) && (row_end <= column_height) && (level < mip_levels()));
+    if (row_begin == row_end) return;
+
+    const size_t size = m_texture_size >> level;
+    const uint32_t* texels = sampled_texels(level, shade);
+
+    ColumnSpan span;
+    if (m_level_count)
+    {
+        span.src        = &texels[(texture_id*size + (texture_coord >> level))*size];
+        span.src_stride = 1;
+    }
+    else
+    {
+        span.src        = &texels[texture_coord + texture_id*m_texture_size];
+        span.src_stride = m_img_w;
+    }
+    span.dst        = dst;
+    span.dst_stride = dst_stride;
+    span.count      = row_end - row_begin;
+    setup_column_span(span, size, column_height, row_begin);
+
+    const BlitKernels& kernels = blit_kernels();
+    if (!alpha_test)
+    {
+        kernels.copy(span);
+        return;
+    }
+
+    // Copy the opaque runs outright. Output row y shows texel (y*size)/column_height, so the run
+    // [begin, end) covers rows [ceil(begin*column_height/size), ceil(end*column_height/size)).
+    const size_t column = texture_id*size + (texture_coord >> level);
+    const uint32_t* offsets = m_run_offsets[level];
+
+    for (uint32_t r = offsets[column]; r < offsets[column + 1]; r++)
+    {
+        const OpaqueRun& run = m_runs[level][r];
+        const size_t y0 = std::max(row_begin, (run.begin * column_height + size - 1) / size);
+        const size_t y1 = std::min(row_end, (run.end * column_height + size - 1) / size);
+        if (y0 >= row_end) break;
+        if (y0 >= y1) continue;
+
+        span.dst   = dst + (y0 - row_begin) * dst_stride;
+        span.count = y1 - y0;
+        setup_column_span(span, size, column_height, y0);
+        kernels.copy(span);
+    }
+}
+
+
+template <unsigned size_shift, bool alpha_test>
+void Texture::copy_scaled_column(const size_t texture_id, const size_t texture_coord, const size_t column_height,
+                                 const size_t row_begin, const size_t row_end, uint32_t* dst, const size_t dst_stride,
+                                 const size_t level, const size_t shade) const
+{
+    assert((m_texture_size == size_t(1) << size_shift) && (texture_coord < m_texture_size) && (texture_id < m_texture_count)
+           && (row_begin <= row_end) && (row_end <= column_height) && (level < mip_levels()));
+    if (row_begin == row_end) return;
+
+    const unsigned level_shift = size_shift - unsigned(level);
+    const size_t size = size_t(1) << level_shift;
+    const uint32_t* texels = sampled_texels(level, shade);
+
+    ColumnSpan span;
+    if (m_level_count)
+    {
+        span.src        = &texels[((texture_id << level_shift) + (texture_coord >> level)) << level_shift];
+        span.src_stride = 1;
+    }
+    else
+    {
+        span.src        = &texels[texture_coord + (texture_id << size_shift)];
+        span.src_stride = m_img_w;
+    }
+    span.dst        = dst;
+    span.dst_stride = dst_stride;
+    span.count      = row_end - row_begin;
+    setup_column_span_pow2(span, level_shift, column_height, row_begin);
+
+    const BlitKernels& kernels = blit_kernels();
+    if (!alpha_test)
+    {
+        kernels.copy(span);
+        return;
+    }
+
+    // The run bounds of the generic version, ceil(begin*column_height/size), as a shift
+    const size_t column = (texture_id << level_shift) + (texture_coord >> level);
+    const uint32_t* offsets = m_run_offsets[level];
+
+    for (uint32_t r = offsets[column]; r < offsets[column + 1]; r++)
     {
-        column[y] = get_px_from_texture(texture_coord, (y*m_texture_size)/column_height, texture_id);
+        const OpaqueRun& run = m_runs[level][r];
+        const size_t y0 = std::max(row_begin, (run.begin * column_height + size - 1) >> level_shift);
+        const size_t y1 = std::min(row_end, (run.end * column_height + size - 1) >> level_shift);
+        if (y0 >= row_end) break;
+        if (y0 >= y1) continue;
+
+        span.dst   = dst + (y0 - row_begin) * dst_stride;
+        span.count = y1 - y0;
+        setup_column_span_pow2(span, level_shift, column_height, y0);
+        kernels.copy(span);
     }
+}
+
+
+// make SPECIALIZE=0 builds only the generic kernels
+#ifndef NO_SPECIALIZED_KERNELS
+template void Texture::copy_scaled_column<5, false>(size_t, size_t, size_t, size_t, size_t, uint32_t*, size_t, size_t, size_t) const;
+template void Texture::copy_scaled_column<5, true>(size_t, size_t, size_t, size_t, size_t, uint32_t*, size_t, size_t, size_t) const;
+template void Texture::copy_scaled_column<6, false>(size_t, size_t, size_t, size_t, size_t, uint32_t*, size_t, size_t, size_t) const;
+template void Texture::copy_scaled_column<6, true>(size_t, size_t, size_t, size_t, size_t, uint32_t*, size_t, size_t, size_t) const;
+template void Texture::copy_scaled_column<7, false>(size_t, size_t, size_t, size_t, size_t, uint32_t*, size_t, size_t, size_t) const;
+template void Texture::copy_scaled_column<7, true>(size_t, size_t, size_t, size_t, size_t, uint32_t*, size_t, size_t, size_t) const;
+template void Texture::copy_scaled_column<8, false>(size_t, size_t, size_t, size_t, size_t, uint32_t*, size_t, size_t, size_t) const;
+template void Texture::copy_scaled_column<8, true>(size_t, size_t, size_t, size_t, size_t, uint32_t*, size_t, size_t, size_t) const;
+#endif
+
+
+std::vector<Texture> load_textures(const std::vector<std::string>& filenames, const uint32_t format,
+                                   const TextureOptions& options)
+{
+    std::vector<std::future<Texture>> loads;
+    for (const std::string& filename : filenames)
+        loads.push_back(std::async(std::launch::async, [&options, format, filename]() { return Texture(filename, format, options); }));
 
-    return column;  // automatically uses move
+    std::vector<Texture> textures;
+    for (std::future<Texture>& load : loads)
+        textures.push_back(load.get());
+    return textures;
 }
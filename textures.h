@@ -1,31 +1,148 @@
 #include <cstdint>
 #include <vector>
+#include <string>
+#include <memory>
 #ifndef TEXTURES_H
 #define TEXTURES_H
 
 
-class Texture 
+// Storage used when sampling texture columns
+enum class TextureLayout
 {
+    atlas,        // Row-major atlas as loaded: texels of a column are m_img_w apart
+    column_major  // Extra per-texture transposed copy: each texture column is one contiguous run
+};
+
+
+struct TextureOptions
+{
+    TextureLayout layout = TextureLayout::column_major;
+    bool mipmaps = true;    // Build box-filtered mip levels (column_major layout only)
+    std::string cache_dir;  // When not empty, keep a preprocessed copy of each texture here (see Texture)
+    size_t shade_levels = 1;  // Copies of the texels for distance shading, copy s blended s/shade_levels
+                              // of the way to fog_colour; 1 = unshaded only
+    uint32_t fog_colour = 0;  // R8G8B8, the alpha of each texel is kept
+};
+
+
+// N square textures packed horizontally in one bitmap.
+//
+// Everything the renderer samples (the atlas, the column-major levels and the opaque runs) is kept
+// in one block, laid out exactly as the cache file written with TextureOptions::cache_dir:
+//   header: "FPSTEX2\0", the size and time of the bitmap it was built from, the pixel format,
+//           the dimensions and options, then the byte offset of every section below
+//   row-major atlas, then per level the column-major texels, the opaque runs and the run offsets,
+//   then the shaded copies: for shade 1 to shade_levels-1, the atlas or every column-major level,
+//   each section aligned to 64 bytes
+// A cache built from the same bitmap with the same options is mapped read-only and used in place,
+// so a warm start skips decoding and preprocessing entirely. The file is in native byte order.
+class Texture
+{
+public:
+    static constexpr size_t max_levels = 16;
+    static constexpr size_t max_shades = 64;
+
+private:
     size_t m_img_w;
     size_t m_img_h;
 
     size_t m_texture_count;
     size_t m_texture_size;  // In pixels
 
-    std::vector<uint32_t> m_img;  // Textures storage container
+    TextureOptions m_options;
+
+    std::shared_ptr<const void> m_storage;  // Heap buffer or cache file mapping holding the data below
+    size_t m_storage_bytes;
+    bool m_from_cache;
+
+    const uint32_t* m_img;  // Row-major atlas, m_img_w x m_img_h
+
+    // Column-major copies, level 0 at full size then each mip level half the size of the previous.
+    // Texel (i,j) of texture idx at level l, of size s = m_texture_size >> l, is at (idx*s + i)*s + j.
+    size_t m_level_count;   // 0 with the atlas layout
+    const uint32_t* m_levels[max_levels];
+
+    // Opaque texel rows [begin, end) of each texture column, per sampling level. The runs of column
+    // i of texture idx at level l are m_runs[l][m_run_offsets[l][idx*s + i] .. m_run_offsets[l][idx*s + i + 1]).
+    struct OpaqueRun
+    {
+        uint32_t begin;
+        uint32_t end;
+    };
+    const OpaqueRun* m_runs[max_levels];
+    const uint32_t* m_run_offsets[max_levels];
+
+    // Shade s > 0 of level l starts at m_shades + (s-1)*m_shade_stride + m_shade_offsets[l] and is laid out as
+    // the unshaded level (the atlas with the atlas layout). Shading keeps alpha, so the runs are shared.
+    size_t m_shade_levels;
+    const uint32_t* m_shades;
+    size_t m_shade_stride;
+    size_t m_shade_offsets[max_levels];
+
+    const uint32_t* sampled_texels(const size_t level, const size_t shade) const;
+
+    bool load_bitmap(const std::string& filename, const uint32_t format, std::vector<uint32_t>& img);
+    void build(const std::vector<uint32_t>& img, const uint64_t source_size, const int64_t source_time,
+               const uint32_t format);
+    bool load_cache(const std::string& cache_file, const uint64_t source_size, const int64_t source_time,
+                    const uint32_t format);
+    static bool runs_valid(const uint32_t* offsets, const OpaqueRun* runs, const size_t columns, const size_t level_size);
+    void assign_storage(const std::shared_ptr<const void>& storage, const size_t bytes);
 
 public:
-    Texture(const std::string& filename, const uint32_t format);
+    // Empty (texture_count() is 0) if the bitmap cannot be loaded; the error is printed
+    Texture(const std::string& filename, const uint32_t format,
+            const TextureOptions& options = TextureOptions());
 
     size_t texture_size() const;
     size_t texture_count() const;
-    
+    TextureLayout layout() const;
+    size_t mip_levels() const;   // Number of sampling levels, 1 without mipmaps
+    size_t memory_bytes() const;
+    bool from_cache() const;     // Mapped from the cache rather than decoded
+    size_t shade_levels() const; // 1 without shaded copies
+
+    // Level whose texels map closest to one pixel when a texture is drawn out_size pixels tall
+    size_t mip_level(const size_t out_size) const;
+
     // Get the pixel (i,j) from the texture idx
-    uint32_t get_px_from_texture(const size_t px_i, const size_t px_j, const size_t texture_idx) const; 
-    
-    // Retrieve one column (tex_coord) from the texture texture_id and scale it to the destination size
-    std::vector<uint32_t> get_scaled_column(const size_t texture_id, const size_t texture_coord, const size_t column_height) const; 
+    uint32_t get_px_from_texture(const size_t px_i, const size_t px_j, const size_t texture_idx) const;
+
+    // Direct access to the texels of one sampling level, for loops fetching texels one by one across
+    // many textures: texel (i,j) of texture idx, of size size, is texels[idx*texture_stride + i*stride_i + j*stride_j]
+    struct TexelView
+    {
+        const uint32_t* texels;
+        size_t size;
+        size_t texture_stride;
+        size_t stride_i;
+        size_t stride_j;
+    };
+    TexelView texel_view(const size_t level = 0, const size_t shade = 0) const;
+
+    // Scale one column (texture_coord, in full size texels) of the texture texture_id at mip level
+    // level to column_height pixels and write rows [row_begin, row_end) of the result to dst,
+    // stepping dst_stride pixels between rows. With alpha_test, texels with alpha <= 128 leave dst untouched:
+    // only the opaque runs of the column are drawn, so transparent rows cost nothing.
+    // shade picks one of the shaded copies, 0 being the texture as loaded.
+    void copy_scaled_column(const size_t texture_id, const size_t texture_coord, const size_t column_height,
+                            const size_t row_begin, const size_t row_end,
+                            uint32_t* dst, const size_t dst_stride, const bool alpha_test = false,
+                            const size_t level = 0, const size_t shade = 0) const;
+
+    // copy_scaled_column for a texture of 1 << size_shift texels (texture_size() must match): the
+    // level sizes are shifts and the opaque runs are placed without dividing by the level size.
+    // Instantiated for size_shift 5 to 8 (32 to 256 texels), with and without the alpha test.
+    template <unsigned size_shift, bool alpha_test>
+    void copy_scaled_column(const size_t texture_id, const size_t texture_coord, const size_t column_height,
+                            const size_t row_begin, const size_t row_end, uint32_t* dst, const size_t dst_stride,
+                            const size_t level = 0, const size_t shade = 0) const;
 };
 
 
-#endif
\ No newline at end of file
+// Load several bitmaps at once, one thread each, in the order given
+std::vector<Texture> load_textures(const std::vector<std::string>& filenames, const uint32_t format,
+                                   const TextureOptions& options = TextureOptions());
+
+
+#endif
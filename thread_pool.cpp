@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <cassert>
+
+#include "thread_pool.h"
+
+
+ThreadPool::ThreadPool(size_t thread_count)
+    : m_workers(), m_queues(), m_generation(0), m_busy(0), m_stop(false),
+      m_fn(nullptr), m_ctx(nullptr), m_count(0), m_grain(1)
+{
+    if (!thread_count)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    for (size_t i = 0; i < thread_count; i++)
+        m_queues.push_back(std::make_unique<WorkQueue>());
+
+    // Queue 0 belongs to the calling thread
+    for (size_t i = 1; i < thread_count; i++)
+        m_workers.emplace_back(&ThreadPool::worker_loop, this, i);
+}
+
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+
+    for (std::thread& worker : m_workers)
+        worker.join();
+}
+
+
+size_t ThreadPool::thread_count() const { return m_queues.size(); }
+
+
+void ThreadPool::worker_loop(const size_t queue_idx)
+{
+    size_t seen_generation = 0;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_wake.wait(lock, [&] { return m_stop || m_generation != seen_generation; });
+            if (m_stop) return;
+            seen_generation = m_generation;
+        }
+
+        run_chunks(queue_idx);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if (--m_busy == 0) m_done.notify_one();
+        }
+    }
+}
+
+
+bool ThreadPool::pop_chunk(const size_t queue_idx, size_t& chunk)
+{
+    // Own queue first, from the front
+    {
+        WorkQueue& own = *m_queues[queue_idx];
+        std::lock_guard<std::mutex> lock(own.mtx);
+        if (own.begin < own.end)
+        {
+            chunk = own.begin++;
+            return true;
+        }
+    }
+
+    // Then steal from the back of the others
+    for (size_t k = 1; k < m_queues.size(); k++)
+    {
+        WorkQueue& victim = *m_queues[(queue_idx + k) % m_queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mtx);
+        if (victim.begin < victim.end)
+        {
+            chunk = --victim.end;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+void ThreadPool::run_chunks(const size_t queue_idx)
+{
+    size_t chunk;
+    while (pop_chunk(queue_idx, chunk))
+    {
+        size_t begin = chunk * m_grain;
+        size_t end = std::min(begin + m_grain, m_count);
+        m_fn(m_ctx, begin, end);
+    }
+}
+
+
+void ThreadPool::run(const size_t count, const size_t grain, JobFn fn, void* ctx)
+{
+    assert(grain > 0);
+    if (!count) return;
+
+    const size_t chunk_count = (count + grain - 1) / grain;
+
+    // Nothing to share: skip the wake-up round trip
+    if (m_workers.empty() || chunk_count == 1)
+    {
+        fn(ctx, 0, count);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_fn = fn;
+        m_ctx = ctx;
+        m_count = count;
+        m_grain = grain;
+
+        // Deal contiguous blocks of chunks to each queue
+        const size_t queue_count = m_queues.size();
+        for (size_t i = 0; i < queue_count; i++)
+        {
+            std::lock_guard<std::mutex> queue_lock(m_queues[i]->mtx);
+            m_queues[i]->begin = chunk_count *  i      / queue_count;
+            m_queues[i]->end   = chunk_count * (i + 1) / queue_count;
+        }
+
+        m_busy = m_workers.size();
+        m_generation++;
+    }
+    m_wake.notify_all();
+
+    run_chunks(0);
+
+    std::unique_lock<std::mutex> lock(m_mtx);
+    m_done.wait(lock, [&] { return m_busy == 0; });
+}
@@ -0,0 +1,71 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <cstdlib>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <type_traits>
+
+
+// Persistent pool of worker threads running data-parallel loops. Each parallel_for splits
+// its range into chunks dealt evenly to per-thread queues; a thread that runs out of work
+// steals chunks from the back of the other queues, so uneven chunks do not starve anyone.
+class ThreadPool
+{
+    // Range of chunk indices still owned by one thread
+    struct WorkQueue
+    {
+        std::mutex mtx;
+        size_t begin = 0;
+        size_t end = 0;
+    };
+
+    typedef void (*JobFn)(void* ctx, size_t begin, size_t end);
+
+    std::vector<std::thread> m_workers;
+    std::vector<std::unique_ptr<WorkQueue>> m_queues;  // One per worker plus one for the calling thread
+
+    std::mutex m_mtx;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    size_t m_generation;   // Bumped for every job so sleeping workers know to wake
+    size_t m_busy;         // Workers still inside the current job
+    bool m_stop;
+
+    // Current job
+    JobFn m_fn;
+    void* m_ctx;
+    size_t m_count;
+    size_t m_grain;
+
+    void worker_loop(const size_t queue_idx);
+    void run_chunks(const size_t queue_idx);
+    bool pop_chunk(const size_t queue_idx, size_t& chunk);
+    void run(const size_t count, const size_t grain, JobFn fn, void* ctx);
+
+public:
+    // thread_count includes the calling thread; 0 picks one per hardware thread
+    explicit ThreadPool(size_t thread_count = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t thread_count() const;
+
+    // Call fn(begin, end) over [0, count) in chunks of at most grain items and wait for all
+    // of them. The calling thread takes part in the work.
+    template <typename Fn>
+    void parallel_for(const size_t count, const size_t grain, Fn&& fn)
+    {
+        typedef typename std::remove_reference<Fn>::type F;
+        run(count, grain, [](void* ctx, size_t begin, size_t end) { (*static_cast<F*>(ctx))(begin, end); },
+            const_cast<void*>(static_cast<const void*>(&fn)));
+    }
+};
+
+
+#endif
@@ -3,6 +3,20 @@
 #include <vector>
 #include <cstdint>
 #include <cassert>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define UTILS_MMAP 1
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define UTILS_X86 1
+#include <immintrin.h>
+#endif
 
 #include "utils.h"
 
@@ -22,20 +36,112 @@ void unpack_colour(const uint32_t& colour, uint8_t& r, uint8_t& g, uint8_t& b, u
 }
 
 
-void drop_ppm_image(const std::string& filename, const std::vector<uint32_t>& img, 
+static void rgba_to_rgb_scalar(const uint32_t* src, const size_t count, uint8_t* dst)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        uint8_t a;
+        unpack_colour(src[i], dst[3*i], dst[3*i + 1], dst[3*i + 2], a);
+    }
+}
+
+
+#ifdef UTILS_X86
+
+// Sixteen pixels per step: each register of four pixels is packed down to twelve bytes, then the
+// four results are merged into three full stores
+__attribute__((target("ssse3"))) static void rgba_to_rgb_ssse3(const uint32_t* src, const size_t count, uint8_t* dst)
+{
+    const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const size_t blocks = count / 16;
+
+    for (size_t b = 0; b < blocks; b++, src += 16, dst += 48)
+    {
+        __m128i p0 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src)),      pack);
+        __m128i p1 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 4)),  pack);
+        __m128i p2 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 8)),  pack);
+        __m128i p3 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 12)), pack);
+
+        __m128i* out = reinterpret_cast<__m128i*>(dst);
+        _mm_storeu_si128(out,     _mm_or_si128(p0, _mm_slli_si128(p1, 12)));
+        _mm_storeu_si128(out + 1, _mm_or_si128(_mm_srli_si128(p1, 4), _mm_slli_si128(p2, 8)));
+        _mm_storeu_si128(out + 2, _mm_or_si128(_mm_srli_si128(p2, 8), _mm_slli_si128(p3, 4)));
+    }
+
+    rgba_to_rgb_scalar(src, count - blocks * 16, dst);
+}
+
+#endif
+
+
+void rgba_to_rgb(const uint32_t* src, const size_t count, uint8_t* dst)
+{
+#ifdef UTILS_X86
+    static const bool ssse3 = __builtin_cpu_supports("ssse3");
+    if (ssse3)
+    {
+        rgba_to_rgb_ssse3(src, count, dst);
+        return;
+    }
+#endif
+    rgba_to_rgb_scalar(src, count, dst);
+}
+
+
+bool drop_ppm_image(const std::string& filename, const std::vector<uint32_t>& img,
                     const size_t img_w, const size_t img_h)
 {
     assert(img.size() == img_w * img_h);
 
+    const std::string header = "P6\n" + std::to_string(img_w) + " " + std::to_string(img_h) + "\n255\n";
+    std::vector<uint8_t> data(header.size() + img.size() * 3);
+    std::memcpy(data.data(), header.data(), header.size());
+    rgba_to_rgb(img.data(), img.size(), data.data() + header.size());
+
     std::ofstream ofs(filename, std::ios::binary);
-    ofs << "P6\n" << img_w << " " << img_h << "\n255\n";
+    ofs.write(reinterpret_cast<const char*>(data.data()), data.size());
+
+    if (!ofs)
+    {
+        std::cerr << "Error: cannot write image " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+std::shared_ptr<const void> map_file(const std::string& filename, size_t& size)
+{
+    std::shared_ptr<const void> storage;
+    size = 0;
+
+#ifdef UTILS_MMAP
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        const size_t file_size = st.st_size;
+        void* addr = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED)
+        {
+            storage = std::shared_ptr<const void>(addr, [file_size](const void* p) { munmap(const_cast<void*>(p), file_size); });
+            size = file_size;
+        }
+    }
+    if (fd >= 0) close(fd);
+#endif
 
-    for (size_t i=0; i < img_w*img_h; ++i)
+    if (!storage)  // No mmap on this platform, or it failed: read the file into memory instead
     {
-        uint8_t r, g, b, a;
-        unpack_colour(img[i], r, g, b, a);
-        ofs << static_cast<char>(r) << static_cast<char>(g) << static_cast<char>(b);
+        std::ifstream ifs(filename, std::ios::binary | std::ios::ate);
+        const size_t file_size = ifs ? size_t(ifs.tellg()) : 0;
+        std::shared_ptr<std::vector<uint64_t>> buffer = std::make_shared<std::vector<uint64_t>>((file_size + 7) / 8);
+        ifs.seekg(0);
+        ifs.read(reinterpret_cast<char*>(buffer->data()), file_size);
+        if (!ifs || !file_size) return nullptr;
+        storage = std::shared_ptr<const void>(buffer, buffer->data());
+        size = file_size;
     }
 
-    ofs.close();
+    return storage;
 }
\ No newline at end of file
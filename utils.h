@@ -4,13 +4,22 @@
 #include <vector>
 #include <cstdint>
 #include <string>
+#include <memory>
 
 // Pack into R8G8B8A8 colour
 uint32_t pack_colour(const uint8_t r, const uint8_t g, const uint8_t b, const uint8_t a = 255);
 
 void unpack_colour(const uint32_t& colour, uint8_t& r, uint8_t& g, uint8_t& b, uint8_t& a);
 
-void drop_ppm_image(const std::string& filename, const std::vector<uint32_t>& img, 
+// Drop the alpha of count R8G8B8A8 pixels: dst receives 3*count bytes, R G B for each pixel
+void rgba_to_rgb(const uint32_t* src, const size_t count, uint8_t* dst);
+
+// Binary PPM, written with a single write; the error is printed on failure
+bool drop_ppm_image(const std::string& filename, const std::vector<uint32_t>& img,
                     const size_t img_w, const size_t img_h);
 
+// Whole file, mapped read-only where mmap is available and read into memory otherwise.
+// nullptr (and size 0) if the file cannot be read.
+std::shared_ptr<const void> map_file(const std::string& filename, size_t& size);
+
 #endif
\ No newline at end of file
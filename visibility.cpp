@@ -0,0 +1,388 @@
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
+#include <bit>
+
+#include "visibility.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+
+// Cache file header, also kept at the front of the in-memory storage
+struct VisibilityHeader
+{
+    char magic[8];
+    uint64_t map_hash;
+    uint32_t map_width;
+    uint32_t map_height;
+    uint32_t region_size;
+    uint32_t max_dist;
+    uint32_t edge_samples;
+    uint32_t rays;
+    uint32_t regions_x;
+    uint32_t regions_y;
+    uint32_t window;
+    uint32_t words_per_region;
+    uint64_t total_bytes;
+};
+static_assert(sizeof(VisibilityHeader) == 64, "visibility header must stay 64 bytes");
+
+static const char visibility_magic[8] = {'F', 'P', 'S', 'P', 'V', 'S', '2', '\0'};
+
+
+// The settings the sets are actually built with: a power of two region size, at least one of everything
+static VisibilitySettings normalized(const VisibilitySettings& settings)
+{
+    VisibilitySettings s = settings;
+    s.region_size  = std::bit_ceil(std::max<size_t>(1, settings.region_size));
+    s.max_dist     = std::max<size_t>(1, settings.max_dist);
+    s.edge_samples = std::max<size_t>(1, settings.edge_samples);
+    s.rays         = std::max<size_t>(1, settings.rays);
+    return s;
+}
+
+
+// Header of the sets of a width x height map, total_bytes included
+static VisibilityHeader make_header(const size_t width, const size_t height, const VisibilitySettings& s,
+                                    const uint64_t map_hash)
+{
+    // A ray stops in the first cell it enters past max_dist, less than max_dist + 1 cells from its
+    // origin, and the sets are then widened by one region
+    const size_t window = (s.max_dist + s.region_size) / s.region_size + 1;
+    const size_t side = 2*window + 1;
+
+    VisibilityHeader header{};
+    std::memcpy(header.magic, visibility_magic, sizeof(visibility_magic));
+    header.map_hash         = map_hash;
+    header.map_width        = uint32_t(width);
+    header.map_height       = uint32_t(height);
+    header.region_size      = uint32_t(s.region_size);
+    header.max_dist         = uint32_t(s.max_dist);
+    header.edge_samples     = uint32_t(s.edge_samples);
+    header.rays             = uint32_t(s.rays);
+    header.regions_x        = uint32_t((width + s.region_size - 1) / s.region_size);
+    header.regions_y        = uint32_t((height + s.region_size - 1) / s.region_size);
+    header.window           = uint32_t(window);
+    header.words_per_region = uint32_t((side*side + 63) / 64);
+    header.total_bytes      = sizeof(VisibilityHeader)
+                            + uint64_t(header.regions_x) * header.regions_y * header.words_per_region * sizeof(uint64_t);
+    return header;
+}
+
+
+Visibility::Visibility()
+    : m_map_width(0), m_map_height(0), m_region_shift(0), m_regions_x(0), m_regions_y(0), m_window(0),
+      m_words_per_region(0), m_max_dist(0), m_storage(), m_storage_bytes(0), m_bits(nullptr), m_from_cache(false)
+{
+}
+
+
+Visibility::Visibility(const Map& map, const VisibilitySettings& settings)
+    : Visibility()
+{
+    if (!map.width() || !map.height()) return;
+
+    const VisibilitySettings s = normalized(settings);
+    const uint64_t map_hash = map.wall_hash();
+
+    std::string cache_file;
+    if (!s.cache_dir.empty())
+    {
+        std::ostringstream name;
+        name << "map-" << std::hex << std::setw(16) << std::setfill('0') << map_hash << std::dec
+             << "-" << map.width() << "x" << map.height() << ".r" << s.region_size << ".d" << s.max_dist
+             << ".s" << s.edge_samples << ".a" << s.rays << ".pvs";
+        cache_file = (std::filesystem::path(s.cache_dir) / name.str()).string();
+        if (load_cache(cache_file, map, s, map_hash)) return;
+    }
+
+    build(map, s, map_hash);
+
+    if (cache_file.empty()) return;
+
+    // Written aside then renamed, so a concurrent start never maps a half written cache
+    std::error_code ec;
+    const std::string tmp_file = cache_file + ".tmp";
+    std::filesystem::create_directories(s.cache_dir, ec);
+    std::ofstream ofs(tmp_file, std::ios::binary);
+    ofs.write(static_cast<const char*>(m_storage.get()), m_storage_bytes);
+    ofs.close();
+    if (ofs) std::filesystem::rename(tmp_file, cache_file, ec);
+    if (!ofs || ec)
+    {
+        std::cerr << "Error: cannot write visibility cache " << cache_file << std::endl;
+        std::filesystem::remove(tmp_file, ec);
+    }
+}
+
+
+void Visibility::build(const Map& map, const VisibilitySettings& settings, const uint64_t map_hash)
+{
+    const VisibilityHeader header = make_header(map.width(), map.height(), settings, map_hash);
+    std::shared_ptr<std::vector<uint64_t>> buffer = std::make_shared<std::vector<uint64_t>>(header.total_bytes / 8, 0);
+    std::memcpy(buffer->data(), &header, sizeof(header));
+    uint64_t* bits = buffer->data() + sizeof(header) / 8;
+
+    const int w = int(map.width());
+    const int h = int(map.height());
+    const size_t shift = size_t(std::countr_zero(settings.region_size));
+    const int region = int(settings.region_size);
+    const size_t regions_x = header.regions_x;
+    const size_t regions_y = header.regions_y;
+    const size_t regions = regions_x * regions_y;
+    const size_t window = header.window;
+    const size_t side = 2*window + 1;
+    const size_t words = header.words_per_region;
+    const double max_dist = double(settings.max_dist);
+    const size_t samples = settings.edge_samples;
+
+    // Ray directions for each edge, east, south, west and north, spread evenly over the half plane
+    // the edge faces, the grazing directions along the edge left out
+    struct Ray
+    {
+        double dir_x;
+        double dir_y;
+        double delta_x;  // Ray length across one cell along each axis
+        double delta_y;
+        int step_i;
+        int step_j;
+    };
+    std::vector<Ray> rays(4 * settings.rays);
+    for (size_t edge = 0; edge < 4; edge++)
+    {
+        for (size_t k = 0; k < settings.rays; k++)
+        {
+            const double angle = edge * M_PI/2 - M_PI/2 + M_PI * (k + 0.5) / settings.rays;
+            Ray& ray = rays[edge*settings.rays + k];
+            ray.dir_x = std::cos(angle);
+            ray.dir_y = std::sin(angle);
+            ray.delta_x = ray.dir_x == 0 ? 1e30 : std::abs(1 / ray.dir_x);
+            ray.delta_y = ray.dir_y == 0 ? 1e30 : std::abs(1 / ray.dir_y);
+            ray.step_i = ray.dir_x < 0 ? -1 : 1;
+            ray.step_j = ray.dir_y < 0 ? -1 : 1;
+        }
+    }
+
+    auto mark = [&](uint64_t* set, const long origin_rx, const long origin_ry, const long rx, const long ry)
+    {
+        const size_t bit = size_t(rx - origin_rx + long(window)) + size_t(ry - origin_ry + long(window)) * side;
+        set[bit/64] |= uint64_t(1) << (bit%64);
+    };
+
+    // DDA from (x,y), on the edge of the empty cell (i,j) it enters first, marking the region of
+    // every cell it visits up to the first wall, the map border or max_dist
+    auto trace = [&](uint64_t* set, const long origin_rx, const long origin_ry, const Ray& ray, const double x,
+                     const double y, int i, int j)
+    {
+        double side_x = ray.dir_x < 0 ? (x - i) * ray.delta_x : (i + 1 - x) * ray.delta_x;
+        double side_y = ray.dir_y < 0 ? (y - j) * ray.delta_y : (j + 1 - y) * ray.delta_y;
+        mark(set, origin_rx, origin_ry, i >> shift, j >> shift);
+
+        while (true)
+        {
+            if (side_x < side_y)
+            {
+                if (side_x > max_dist) return;
+                side_x += ray.delta_x;
+                i += ray.step_i;
+                if (i < 0 || i >= w) return;
+            }
+            else
+            {
+                if (side_y > max_dist) return;
+                side_y += ray.delta_y;
+                j += ray.step_j;
+                if (j < 0 || j >= h) return;
+            }
+
+            mark(set, origin_rx, origin_ry, i >> shift, j >> shift);
+            if (!map.is_empty(i, j)) return;
+        }
+    };
+
+    ThreadPool pool(settings.thread_count);
+    pool.parallel_for(regions, 1, [&](size_t begin, size_t end)
+    {
+        for (size_t r = begin; r < end; r++)
+        {
+            const long rx = long(r % regions_x);
+            const long ry = long(r / regions_x);
+            const int x0 = int(rx) * region;
+            const int y0 = int(ry) * region;
+            const int x1 = std::min(w, x0 + region);
+            const int y1 = std::min(h, y0 + region);
+            uint64_t* set = bits + r*words;
+
+            const size_t own = window + window*side;
+            set[own/64] |= uint64_t(1) << (own%64);
+
+            // Rays leave through the edges inside the map, along the cells that are not walls themselves.
+            // Where the cell beyond the edge is a wall, every ray stops there.
+            auto cast = [&](const Ray* edge_rays, const bool open, const double x, const double y, const int i, const int j)
+            {
+                if (!open) return;
+                if (!map.is_empty(i, j))
+                {
+                    mark(set, rx, ry, i >> shift, j >> shift);
+                    return;
+                }
+                for (size_t n = 0; n < settings.rays; n++)
+                    trace(set, rx, ry, edge_rays[n], x, y, i, j);
+            };
+
+            for (int j = y0; j < y1; j++)
+            {
+                const bool east = x1 < w && map.is_empty(x1 - 1, j);
+                const bool west = x0 > 0 && map.is_empty(x0, j);
+                for (size_t s = 0; s < samples; s++)
+                {
+                    const double y = j + (s + 0.5) / samples;
+                    cast(&rays[0], east, x1, y, x1, j);
+                    cast(&rays[2*settings.rays], west, x0, y, x0 - 1, j);
+                }
+            }
+            for (int i = x0; i < x1; i++)
+            {
+                const bool south = y1 < h && map.is_empty(i, y1 - 1);
+                const bool north = y0 > 0 && map.is_empty(i, y0);
+                for (size_t s = 0; s < samples; s++)
+                {
+                    const double x = i + (s + 0.5) / samples;
+                    cast(&rays[settings.rays], south, x, y1, i, y1);
+                    cast(&rays[3*settings.rays], north, x, y0, i, y0 - 1);
+                }
+            }
+        }
+    });
+
+    // Seeing is mutual: whatever one region's rays found sees that region back, which catches
+    // some of what sampling missed from the other side
+    for (size_t r = 0; r < regions; r++)
+    {
+        const long rx = long(r % regions_x);
+        const long ry = long(r / regions_x);
+        for (size_t bit = 0; bit < side*side; bit++)
+        {
+            if (!((bits[r*words + bit/64] >> (bit%64)) & 1)) continue;
+
+            const size_t other = size_t(rx + long(bit % side) - long(window))
+                               + size_t(ry + long(bit / side) - long(window)) * regions_x;
+            const size_t back = side*side - 1 - bit;
+            bits[other*words + back/64] |= uint64_t(1) << (back%64);
+        }
+    }
+
+    // Sampled rays can slip past a region seen only through a narrow gap, though never far from the
+    // regions they do cross: every set takes in the neighbours of its regions, so that what is
+    // missed is at least two regions away from anything found
+    pool.parallel_for(regions, 16, [&](size_t begin, size_t end)
+    {
+        std::vector<uint64_t> found(words);
+        for (size_t r = begin; r < end; r++)
+        {
+            const long rx = long(r % regions_x);
+            const long ry = long(r / regions_x);
+            uint64_t* set = bits + r*words;
+            std::copy(set, set + words, found.begin());
+
+            for (size_t bit = 0; bit < side*side; bit++)
+            {
+                if (!((found[bit/64] >> (bit%64)) & 1)) continue;
+
+                const long di = long(bit % side);
+                const long dj = long(bit / side);
+                for (long nj = std::max(0L, dj - 1); nj <= std::min(long(side) - 1, dj + 1); nj++)
+                    for (long ni = std::max(0L, di - 1); ni <= std::min(long(side) - 1, di + 1); ni++)
+                    {
+                        const long nx = rx + ni - long(window);
+                        const long ny = ry + nj - long(window);
+                        if (nx < 0 || ny < 0 || nx >= long(regions_x) || ny >= long(regions_y)) continue;
+                        const size_t n = size_t(ni + nj*long(side));
+                        set[n/64] |= uint64_t(1) << (n%64);
+                    }
+            }
+        }
+    });
+
+    assign_storage(std::shared_ptr<const void>(buffer, buffer->data()), header.total_bytes);
+}
+
+
+bool Visibility::load_cache(const std::string& cache_file, const Map& map, const VisibilitySettings& settings,
+                            const uint64_t map_hash)
+{
+    if (!std::filesystem::exists(cache_file)) return false;
+
+    size_t file_size = 0;
+    std::shared_ptr<const void> storage = map_file(cache_file, file_size);
+
+    VisibilityHeader header{};
+    if (file_size >= sizeof(header)) std::memcpy(&header, storage.get(), sizeof(header));
+
+    // A stale cache (other walls or settings) is quietly rebuilt, a damaged one is reported first
+    const VisibilityHeader expected = make_header(map.width(), map.height(), settings, map_hash);
+    if (std::memcmp(header.magic, expected.magic, sizeof(expected.magic)) || header.map_hash != expected.map_hash
+        || header.map_width != expected.map_width || header.map_height != expected.map_height
+        || header.region_size != expected.region_size || header.max_dist != expected.max_dist
+        || header.edge_samples != expected.edge_samples || header.rays != expected.rays)
+    {
+        return false;
+    }
+
+    if (std::memcmp(&header, &expected, sizeof(header)) || header.total_bytes > file_size)
+    {
+        std::cerr << "Error: visibility cache " << cache_file << " is truncated or corrupt, rebuilding it" << std::endl;
+        return false;
+    }
+
+    assign_storage(storage, header.total_bytes);
+    m_from_cache = true;
+    return true;
+}
+
+
+void Visibility::assign_storage(const std::shared_ptr<const void>& storage, const size_t bytes)
+{
+    VisibilityHeader header;
+    std::memcpy(&header, storage.get(), sizeof(header));
+
+    m_map_width        = header.map_width;
+    m_map_height       = header.map_height;
+    m_region_shift     = size_t(std::countr_zero(header.region_size));
+    m_regions_x        = header.regions_x;
+    m_regions_y        = header.regions_y;
+    m_window           = header.window;
+    m_words_per_region = header.words_per_region;
+    m_max_dist         = header.max_dist;
+    m_storage          = storage;
+    m_storage_bytes    = bytes;
+    m_bits             = reinterpret_cast<const uint64_t*>(static_cast<const uint8_t*>(storage.get()) + sizeof(header));
+}
+
+
+bool Visibility::valid() const { return m_bits != nullptr; }
+bool Visibility::covers(const Map& map) const { return valid() && map.width() == m_map_width && map.height() == m_map_height; }
+size_t Visibility::region_size() const { return size_t(1) << m_region_shift; }
+size_t Visibility::region_count() const { return m_regions_x * m_regions_y; }
+double Visibility::max_dist() const { return m_max_dist; }
+size_t Visibility::memory_bytes() const { return m_storage_bytes; }
+bool Visibility::from_cache() const { return m_from_cache; }
+
+
+size_t Visibility::visible_regions(const size_t i, const size_t j) const
+{
+    assert(i < m_map_width && j < m_map_height);
+    const uint64_t* set = m_bits + ((i >> m_region_shift) + (j >> m_region_shift)*m_regions_x) * m_words_per_region;
+
+    size_t count = 0;
+    for (size_t k = 0; k < m_words_per_region; k++)
+        count += size_t(std::popcount(set[k]));
+    return count;
+}
@@ -0,0 +1,98 @@
+#ifndef VISIBILITY_H
+#define VISIBILITY_H
+
+#include <cstdlib>
+#include <cstdint>
+#include <cassert>
+#include <string>
+#include <memory>
+
+#include "map.h"
+
+
+struct VisibilitySettings
+{
+    size_t region_size  = 8;   // Cells per side of a region, rounded up to a power of two
+    size_t max_dist     = 32;  // Range in cells; regions farther away are never visible. Sprites beyond it
+                               // are never skipped.
+    size_t edge_samples = 4;   // Ray origins per cell along the edges of each region
+    size_t rays         = 64;  // Rays cast from each origin, spread over the half plane facing out
+    size_t thread_count = 0;   // Build threads, 0 = one per hardware thread
+    std::string cache_dir;     // When not empty, keep the built sets here, keyed on Map::wall_hash()
+};
+
+
+// Potentially visible sets of a map: the map is cut into square regions, and every region has a
+// bitset of the regions that can be seen from somewhere inside it. A region only sees regions
+// within max_dist, so each bitset covers the (2*window+1)^2 regions around its own, one bit per
+// region, row by row: a few words per region whatever the size of the map.
+//
+// A line from inside a region leaves it through an edge, so the sets are built by casting rays
+// outwards from points spread along every edge a region can be left through, marking every
+// region a ray crosses before it hits a wall (that region too) or goes past max_dist. Walls inside
+// the region are ignored, which only makes the sets larger. Directions are sampled, so a region
+// seen only through gaps narrower than the spacing of the rays can be missed; every set is then
+// widened by one region around everything found, which covers those on the maps tried so far.
+// The sets are still sampled rather than exact, which is why the renderer only uses them on request,
+// and then only to skip sprites, never to cut rays short.
+//
+// The sets are kept in one block laid out as the cache file:
+//   64 byte header: "FPSPVS2\0", the wall hash and size of the map, the settings the sets were
+//   built with, the region grid and window, then the bitsets, words_per_region words per region
+// A cache built for the same walls with the same settings is mapped read-only and used in place.
+class Visibility
+{
+    size_t m_map_width;
+    size_t m_map_height;
+    size_t m_region_shift;      // log2 of the region size
+    size_t m_regions_x;
+    size_t m_regions_y;
+    size_t m_window;            // Regions seen are at most this many regions away along each axis
+    size_t m_words_per_region;
+    double m_max_dist;
+
+    std::shared_ptr<const void> m_storage;  // Heap buffer or cache file mapping holding the bitsets
+    size_t m_storage_bytes;
+    const uint64_t* m_bits;
+    bool m_from_cache;
+
+    void build(const Map& map, const VisibilitySettings& settings, const uint64_t map_hash);
+    bool load_cache(const std::string& cache_file, const Map& map, const VisibilitySettings& settings,
+                    const uint64_t map_hash);
+    void assign_storage(const std::shared_ptr<const void>& storage, const size_t bytes);
+
+public:
+    // No sets: valid() is false
+    Visibility();
+
+    // Build the sets of map, or map them from the cache. Errors writing the cache are printed.
+    explicit Visibility(const Map& map, const VisibilitySettings& settings = VisibilitySettings());
+
+    bool valid() const;
+    bool covers(const Map& map) const;   // Built for a map of this size
+    size_t region_size() const;
+    size_t region_count() const;
+    double max_dist() const;
+    size_t memory_bytes() const;
+    bool from_cache() const;
+
+    // Regions visible from the region of cell (i,j), its own included
+    size_t visible_regions(const size_t i, const size_t j) const;
+
+    // Whether cell (to_i,to_j) may be seen from cell (from_i,from_j)
+    bool visible(const size_t from_i, const size_t from_j, const size_t to_i, const size_t to_j) const
+    {
+        assert(from_i < m_map_width && from_j < m_map_height && to_i < m_map_width && to_j < m_map_height);
+        const long di = long(to_i >> m_region_shift) - long(from_i >> m_region_shift) + long(m_window);
+        const long dj = long(to_j >> m_region_shift) - long(from_j >> m_region_shift) + long(m_window);
+        const long side = long(2*m_window + 1);
+        if (di < 0 || dj < 0 || di >= side || dj >= side) return false;
+
+        const size_t bit = size_t(di + dj*side);
+        const size_t region = (from_i >> m_region_shift) + (from_j >> m_region_shift)*m_regions_x;
+        return (m_bits[region*m_words_per_region + bit/64] >> (bit%64)) & 1;
+    }
+};
+
+
+#endif